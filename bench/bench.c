@@ -0,0 +1,237 @@
+/*
+* Renders a set of fixed scenes as fast as possible and prints their frame statistics.
+* Also used to train the profile guided build (make pgo).
+*
+* Usage: bench [--frames N] [--scene NAME] [--render-thread] [--streaming] [--elide] [--dirty-rects]
+*             [--replay CAPTURE]
+*/
+#include "../include/o2d.h"
+
+#ifndef M_PI
+#define M_PI 3.1415926535897932384
+#endif
+
+enum {
+    BENCH_TEXTURE_NUM = 48, // More than the texture slots, so batches get split
+    BENCH_OBJECT_NUM = 20000,
+    BENCH_TEXTURE_SIZE = 32,
+};
+
+typedef struct Bench_t {
+    O2D_Renderer renderer;
+    uint32_t textures[BENCH_TEXTURE_NUM];
+    float positions[BENCH_OBJECT_NUM][2];
+    O2D_Vertex quads[BENCH_OBJECT_NUM * 4]; // 16x16 rectangles at positions, 4 vertices each
+    uint32_t quadTextures[BENCH_OBJECT_NUM]; // Like DrawTextures()
+    uint32_t frame;
+} Bench;
+
+typedef struct BenchScene_t {
+    const char *name;
+    void (*draw)(Bench *bench);
+} BenchScene;
+
+// Opaque textures have full alpha, the others a transparent border
+uint32_t MakeTexture(uint32_t seed, bool opaque) {
+    uint8_t pixels[BENCH_TEXTURE_SIZE * BENCH_TEXTURE_SIZE * 4];
+    for (uint32_t y = 0; y < BENCH_TEXTURE_SIZE; y++) {
+        for (uint32_t x = 0; x < BENCH_TEXTURE_SIZE; x++) {
+            uint8_t *pixel = &pixels[(y * BENCH_TEXTURE_SIZE + x) * 4];
+            bool border = x < 4 || y < 4 || x >= BENCH_TEXTURE_SIZE - 4 || y >= BENCH_TEXTURE_SIZE - 4;
+            pixel[0] = (uint8_t)(seed * 53 + x * 8);
+            pixel[1] = (uint8_t)(seed * 97 + y * 8);
+            pixel[2] = (uint8_t)(seed * 31);
+            pixel[3] = opaque || !border ? 255 : 0;
+        }
+    }
+    return O2D_CreateTexture(pixels, BENCH_TEXTURE_SIZE, BENCH_TEXTURE_SIZE);
+}
+
+// Every object on the same texture
+void DrawQuads(Bench *bench) {
+    for (uint32_t i = 0; i < BENCH_OBJECT_NUM; i++) {
+        O2D_Quad quad;
+        O2D_MakeRect(quad, bench->positions[i][0], bench->positions[i][1], 16, 16, 0);
+        O2D_PushQuad(&bench->renderer, quad, bench->textures[0]);
+    }
+}
+
+// Textures change from one object to the next
+void DrawTextures(Bench *bench) {
+    for (uint32_t i = 0; i < BENCH_OBJECT_NUM; i++) {
+        O2D_Quad quad;
+        O2D_MakeRect(quad, bench->positions[i][0], bench->positions[i][1], 16, 16, 0);
+        O2D_PushQuad(&bench->renderer, quad, bench->textures[i % BENCH_TEXTURE_NUM]);
+    }
+}
+
+// DrawQuads() in a single call
+void DrawQuadsBulk(Bench *bench) {
+    O2D_PushQuads(&bench->renderer, bench->quads, BENCH_OBJECT_NUM, bench->textures[0]);
+}
+
+// DrawTextures() in a single call
+void DrawTexturesBulk(Bench *bench) {
+    O2D_PushQuadsMixed(&bench->renderer, bench->quads, bench->quadTextures, BENCH_OBJECT_NUM);
+}
+
+// Rotating sprites, expanded on the GPU
+void DrawSprites(Bench *bench) {
+    for (uint32_t i = 0; i < BENCH_OBJECT_NUM; i++) {
+        O2D_Sprite sprite = { bench->positions[i][0], bench->positions[i][1], 16, 16,
+                              (float)(bench->frame + i) * 0.01f, { 0, 0, 1, 1 }, { 1, 1, 1, 1 } };
+        O2D_PushSprite(&bench->renderer, &sprite, bench->textures[i % 8]);
+    }
+}
+
+// Opaque and transparent objects interleaved, with the opaque ones drawn front to back
+void DrawDepthSorted(Bench *bench) {
+    O2D_SetDepthSorting(&bench->renderer, true);
+    for (uint32_t i = 0; i < BENCH_OBJECT_NUM; i++) {
+        O2D_Quad quad;
+        O2D_MakeRect(quad, bench->positions[i][0], bench->positions[i][1], 48, 48, 0);
+        O2D_PushQuad(&bench->renderer, quad, bench->textures[i % BENCH_TEXTURE_NUM]);
+    }
+    O2D_SetDepthSorting(&bench->renderer, false);
+}
+
+// A moving camera and state changes between small groups of objects
+void DrawStateChanges(Bench *bench) {
+    O2D_SetCamera(&bench->renderer, 100.0f * sinf(bench->frame * 0.05f), 0);
+    for (uint32_t i = 0; i < BENCH_OBJECT_NUM; i++) {
+        if (i % 500 == 0)
+            O2D_SetTint(&bench->renderer, 1.0f, (i / 500) % 2 ? 0.5f : 1.0f, 1.0f, 1.0f);
+        O2D_Quad quad;
+        O2D_MakeRect(quad, bench->positions[i][0], bench->positions[i][1], 16, 16, (float)M_PI / 4);
+        O2D_PushQuad(&bench->renderer, quad, bench->textures[(i / 100) % BENCH_TEXTURE_NUM]);
+    }
+    O2D_SetTint(&bench->renderer, 1, 1, 1, 1);
+    O2D_SetCamera(&bench->renderer, 0, 0);
+}
+
+// Colored rectangles, tinted quads and triangles between textured quads, all in one batch
+void DrawShapes(Bench *bench) {
+    for (uint32_t i = 0; i < BENCH_OBJECT_NUM; i++) {
+        float x = bench->positions[i][0], y = bench->positions[i][1];
+        uint32_t color = O2D_PackColor((i % 7) / 6.0f, (i % 5) / 4.0f, (i % 3) / 2.0f, 1.0f);
+        O2D_Quad quad;
+        O2D_MakeRect(quad, x, y, 16, 16, 0);
+        if (i % 4 == 0) {
+            O2D_PushQuad(&bench->renderer, quad, bench->textures[0]);
+        }
+        else if (i % 4 == 1) {
+            O2D_PushColoredQuad(&bench->renderer, quad, color);
+        }
+        else if (i % 4 == 2) {
+            O2D_PushQuadTinted(&bench->renderer, quad, bench->textures[0], color);
+        }
+        else {
+            O2D_Vertex triangle[3] = { { x - 8, y + 8, 0, 0, 0, 0, color }, { x + 8, y + 8, 0, 0, 0, 0, color },
+                                       { x, y - 8, 0, 0, 0, 0, 0xFFFFFFFFu } };
+            O2D_PushTriangle(&bench->renderer, triangle, O2D_NO_TEXTURE);
+        }
+    }
+}
+
+const BenchScene scenes[] = {
+    { "quads", DrawQuads },
+    { "textures", DrawTextures },
+    { "bulk", DrawQuadsBulk },
+    { "mixed", DrawTexturesBulk },
+    { "sprites", DrawSprites },
+    { "depth", DrawDepthSorted },
+    { "state", DrawStateChanges },
+    { "shapes", DrawShapes },
+};
+
+void RunScene(Bench *bench, const BenchScene *scene, uint32_t frameNum) {
+    double cpuTime = 0, frameTime = 0, gpuTime = 0;
+    uint64_t uploadedBytes = 0, elidedBytes = 0, redrawnPixels = 0, gpuFrameIndex = 0;
+    uint32_t batchNum = 0, gpuFrameNum = 0;
+    for (bench->frame = 0; bench->frame < frameNum; bench->frame++) {
+        O2D_Begin(&bench->renderer);
+        scene->draw(bench);
+        O2D_End(&bench->renderer);
+        const O2D_FrameStats *stats = O2D_GetFrameStats(&bench->renderer);
+        cpuTime += stats->cpuTime;
+        frameTime += stats->frameTime;
+        batchNum += stats->batchNum;
+        uploadedBytes += stats->uploadedBytes;
+        elidedBytes += stats->elidedBytes;
+        redrawnPixels += stats->redrawnPixels;
+        if (stats->gpuTime > 0 && stats->gpuFrameIndex != gpuFrameIndex) {
+            gpuFrameIndex = stats->gpuFrameIndex;
+            gpuTime += stats->gpuTime;
+            gpuFrameNum++;
+        }
+    }
+    printf("%-10s frame %8.3f ms  cpu %8.3f ms  gpu %8.3f ms  batches %6u  uploaded %8llu B  elided %8llu B  redrawn %8llu px\n",
+           scene->name, frameTime / frameNum, cpuTime / frameNum, gpuFrameNum ? gpuTime / gpuFrameNum : 0.0,
+           batchNum / frameNum, (unsigned long long)(uploadedBytes / frameNum),
+           (unsigned long long)(elidedBytes / frameNum), (unsigned long long)(redrawnPixels / frameNum));
+}
+
+int main(int argc, char **argv) {
+    uint32_t frameNum = 300;
+    const char *sceneName = NULL;
+    const char *replayPath = NULL;
+    bool renderThread = false, streaming = false, elide = false, dirtyRects = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frameNum = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+            sceneName = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (strcmp(argv[i], "--render-thread") == 0)
+            renderThread = true;
+        else if (strcmp(argv[i], "--streaming") == 0)
+            streaming = true;
+        else if (strcmp(argv[i], "--elide") == 0)
+            elide = true;
+        else if (strcmp(argv[i], "--dirty-rects") == 0)
+            dirtyRects = true;
+    }
+    if (frameNum == 0)
+        frameNum = 1;
+
+    static Bench bench;
+    if (!O2D_Create(&bench.renderer, "O2D Bench", 1024, 768))
+        return 1;
+    O2D_SetSwapInterval(&bench.renderer, 0);
+    O2D_EnableGpuTimers(&bench.renderer, true);
+    if (streaming)
+        O2D_SetSubmitMode(&bench.renderer, O2D_SUBMIT_STREAMING);
+    O2D_EnableUploadElision(&bench.renderer, elide);
+    O2D_EnableDirtyRects(&bench.renderer, dirtyRects);
+    if (renderThread)
+        O2D_StartRenderThread(&bench.renderer);
+
+    if (replayPath != NULL) {
+        O2D_ReplayStats stats;
+        if (!O2D_Replay(&bench.renderer, replayPath, 1, &stats)) {
+            O2D_Terminate(&bench.renderer);
+            return 1;
+        }
+        printf("replay     %llu frames  %llu calls  %.3f ms per frame\n", (unsigned long long)stats.frameNum,
+               (unsigned long long)stats.callNum, stats.frameNum ? stats.time / stats.frameNum : 0.0);
+        O2D_Terminate(&bench.renderer);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < BENCH_TEXTURE_NUM; i++)
+        bench.textures[i] = MakeTexture(i, i % 2 == 0);
+    srand(1);
+    for (uint32_t i = 0; i < BENCH_OBJECT_NUM; i++) {
+        bench.positions[i][0] = (float)(rand() % 1024);
+        bench.positions[i][1] = (float)(rand() % 768);
+        O2D_MakeRect(bench.quads + i * 4, bench.positions[i][0], bench.positions[i][1], 16, 16, 0);
+        bench.quadTextures[i] = bench.textures[i % BENCH_TEXTURE_NUM];
+    }
+    for (uint32_t i = 0; i < sizeof(scenes) / sizeof(scenes[0]); i++) {
+        if (sceneName == NULL || strcmp(sceneName, scenes[i].name) == 0)
+            RunScene(&bench, &scenes[i], frameNum);
+    }
+    O2D_Terminate(&bench.renderer);
+    return 0;
+}
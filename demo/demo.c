@@ -2,7 +2,6 @@
 * TODO:
 * - instanced rendering
 * - resizing
-* - drawing triangles and adding colors
 * - camera rotation
 */
 #include "../include/o2d.h"
@@ -29,11 +28,27 @@ void LoadAnimation(O2D_Animation *animation, const char* path, uint16_t frameNum
     stbi_image_free(spritesheetPixelData);
 }
 
-int main() {
+int main(int argc, char **argv) {
     stbi_set_flip_vertically_on_load(true);  
+    bool renderThread = false;
+    const char *hitchPrefix = NULL;
+    for (int32_t i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--render-thread") == 0)
+            renderThread = true;
+        // Writes <prefix>_*.json for frames over 50 ms
+        else if (strcmp(argv[i], "--flight-recorder") == 0 && i + 1 < argc)
+            hitchPrefix = argv[++i];
+        // Keeps linked shader programs in an existing directory between runs
+        else if (strcmp(argv[i], "--shader-cache") == 0 && i + 1 < argc)
+            O2D_SetShaderCacheDirectory(argv[++i]);
+    }
     O2D_Renderer renderer;
     O2D_Create(&renderer, "O2D Demo", 1024, 768);
-    glClearColor(0.3f, 0.5f, 0.7f, 1.0f);
+    O2D_SetClearColor(&renderer, 0.3f, 0.5f, 0.7f, 1.0f);
+    O2D_EnableGpuTimers(&renderer, true);
+    if (hitchPrefix != NULL)
+        O2D_EnableFlightRecorder(&renderer, 50.0, hitchPrefix);
+    O2D_SetSwapInterval(&renderer, 1);
 
     O2D_Animation idle, move, shoot, reload;
     LoadAnimation(&idle, "../demo/res/idle.png", 20, 1000);
@@ -41,15 +56,20 @@ int main() {
     LoadAnimation(&shoot, "../demo/res/shoot.png", 3, 200);
     LoadAnimation(&reload, "../demo/res/reload.png", 20, 1000);
     uint8_t state = 0;
+    if (renderThread)
+        O2D_StartRenderThread(&renderer);
    
     float x = 0, y = 0;
     float w = 300;
     float deltaTime = 0;
     uint64_t frameCount = 0;
-    float deltaTimeSum = 0;
+    double deltaTimeSum = 0;
+    O2D_FrameClock clock;
+    O2D_FrameClockStart(&clock);
+    double gpuTimeSum = 0;
+    uint64_t gpuFrameCount = 0;
+    uint64_t gpuFrameIndex = 0;
     while (O2D_WindowIsOpen(&renderer)) {
-        float startTime = glfwGetTime();
-
         if (glfwGetKey(renderer.window, GLFW_KEY_W))
             y -= 0.1f * deltaTime;
         if (glfwGetKey(renderer.window, GLFW_KEY_S))
@@ -78,14 +98,31 @@ int main() {
             case 2: O2D_PushAnimationFrame(&renderer, &shoot, rect, deltaTime); break;
             case 3: O2D_PushAnimationFrame(&renderer, &reload, rect, deltaTime); break;
         }
+        // Animation progress bar under the character, drawn in the same batch
+        O2D_Animation *animations[4] = { &idle, &move, &shoot, &reload };
+        O2D_Animation *animation = animations[state];
+        float progress = (animation->frameIndex + 1) / (float)animation->frameNum;
+        O2D_Quad bar;
+        O2D_MakeRect(bar, x, y + w * 0.5f + 10, w * 0.5f, 8, 0);
+        O2D_PushColoredQuad(&renderer, bar, O2D_PackColor(0.0f, 0.0f, 0.0f, 0.5f));
+        O2D_MakeRect(bar, x - w * 0.25f * (1.0f - progress), y + w * 0.5f + 10, w * 0.5f * progress, 8, 0);
+        O2D_PushColoredQuad(&renderer, bar, O2D_PackColor(0.3f, 0.9f, 0.4f, 1.0f));
         O2D_End(&renderer);
 
-        float endTime = glfwGetTime();
-        deltaTime = (endTime - startTime) * 1000.0f;
+        O2D_FrameClockTick(&clock);
+        deltaTime = O2D_FrameClockDelta(&clock);
         frameCount++;
         deltaTimeSum += deltaTime;
+        const O2D_FrameStats *stats = O2D_GetFrameStats(&renderer);
+        if (stats->gpuTime > 0 && stats->gpuFrameIndex != gpuFrameIndex) {
+            gpuFrameIndex = stats->gpuFrameIndex;
+            gpuTimeSum += stats->gpuTime;
+            gpuFrameCount++;
+        }
     }
     printf("average delta time: %f\n", deltaTimeSum / frameCount);
+    if (gpuFrameCount > 0)
+        printf("average gpu time: %f\n", gpuTimeSum / gpuFrameCount);
     O2D_Terminate(&renderer);
     return 0;
 }
@@ -1,6 +1,11 @@
 #ifndef O2D_H
 #define O2D_H
 
+// The implementation needs POSIX clocks, see src/o2d.c. o2d.h must come first for this to apply
+#if defined(O2D_IMPLEMENTATION) && !defined(_POSIX_C_SOURCE) && !defined(_WIN32)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -18,42 +23,478 @@ extern "C" {
 
 enum {
     O2D_MIN_VTX_NUM = 64,
-    O2D_MAX_TEX_SLOTS = 32, // This value is hardcoded in the fragment shader
+    O2D_MAX_TEX_SLOTS = 32, // Upper bound for the generated shaders, see O2D_ShaderFeatures
+    O2D_NO_TEXTURE = 0,     // Texture for untextured geometry, drawn as if the texture was white
+    O2D_WHITE_SLOT = 255,   // Texture slot of O2D_NO_TEXTURE. No shader has a sampler there, so it takes no slot
+    O2D_GPU_TIMER_FRAMES = 4,   // Frames in flight before their GPU timings are read back
+    O2D_MAX_TIMED_BATCHES = 32, // Batches timed per frame, the rest are only counted
+    O2D_TRACE_RING_SIZE = 8192, // Trace events kept per thread
+    O2D_TRACE_MAX_THREADS = 16,
+    O2D_FLIGHT_RECORDER_FRAMES = 240, // Frames kept by the flight recorder
+    O2D_FLIGHT_RECORDER_MAX_DUMPS = 16,
+    O2D_MAX_SHADER_VARIANTS = 32,
+    O2D_SHADER_SOURCE_SIZE = 8192,
+    O2D_MAX_DEPTH_STEPS = 1 << 22, // Distinct depths per frame, the upper half of a 24 bit depth buffer
+    O2D_OVERDRAW_BUCKETS = 16,     // Histogram size of the overdraw report
+    O2D_MAX_MESH_POINTS = 16,
+    O2D_CAPTURE_BUFFER_SIZE = 1 << 16, // Bytes encoded before a capture writes to its file
+    O2D_CAPTURE_MAX_WORDS = 22 + 2 * O2D_MAX_MESH_POINTS, // Fields of the largest call, a sprite mesh
+    O2D_CAPTURE_VERSION = 2,
+    O2D_FRAME_ARENA_SIZE = 1 << 18, // Initial size of the per frame arena, it grows to the peak use
+    O2D_FRAME_ARENA_ALIGNMENT = 16,
+    O2D_DEFAULT_MAX_BUFFER_VERTICES = 6 << 18, // 262144 quads in the GPU vertex buffer, see O2D_SetBufferPolicy()
+    O2D_DEFAULT_BUFFER_DECAY_FRAMES = 300,
+    O2D_STREAM_CHUNK_SIZE = 1 << 16, // Bytes of vertices or sprites sealed at once by O2D_SUBMIT_STREAMING
+    O2D_STREAM_CHUNK_NUM = 32,       // Chunks in the streaming ring
+    O2D_MAX_DIRTY_RECTS = 8, // Rectangles redrawn by O2D_EnableDirtyRects(), more get merged
+    O2D_DIRTY_LOOKAHEAD = 32, // Primitives O2D_EnableDirtyRects() looks past to match the previous frame again
+};
+
+// Shader variant features
+enum {
+    O2D_SHADER_TINT = 1 << 0,       // Multiplies the color by uTint
+    O2D_SHADER_ALPHA_TEST = 1 << 1, // Discards fragments with less alpha than uAlphaThreshold
+    O2D_SHADER_BINDLESS = 1 << 2,   // Textures, tint and alpha threshold come from the per draw SSBOs
+    O2D_SHADER_OVERDRAW = 1 << 3,   // Counts every shaded fragment in the R32UI image bound to unit 0
+};
+
+// How the batches of a frame are turned into draw calls
+enum {
+    O2D_SUBMIT_DRAW_ARRAYS,         // One glDrawArrays() per batch
+    O2D_SUBMIT_MULTI_DRAW_INDIRECT, // One glMultiDrawArraysIndirect() per run of batches with the same blending and vertex format
+    O2D_SUBMIT_STREAMING,           // glDrawArrays() as soon as a chunk of the frame has been pushed, see O2D_SetSubmitMode()
+};
+
+// Passes geometry is recorded into, in the order they are drawn
+enum {
+    O2D_PASS_OPAQUE,  // Only with depth sorting: opaque geometry, drawn front to back without blending
+    O2D_PASS_ORDERED, // Everything else, drawn back to front in push order
+    O2D_PASS_NUM,
+};
+
+// Vertex layouts the shader generator knows about
+enum {
+    O2D_VERTEX_FORMAT_BATCH,  // O2D_Vertex
+    O2D_VERTEX_FORMAT_SPRITE, // O2D_SpriteRecord, pulled from an SSBO with gl_VertexID / 6
+};
+
+// Calls a frame capture records. Every call is its opcode byte followed by its fields as varints,
+// each one XORed with the same field of the call of that kind at the same position in the previous
+// frame, or of the previous call of that kind if the previous frame had fewer. Static geometry
+// encodes to one byte per field this way
+enum {
+    O2D_CAPTURE_BEGIN,
+    O2D_CAPTURE_END,
+    O2D_CAPTURE_RENDER_BATCH,
+    O2D_CAPTURE_CLEAR_BATCH,
+    O2D_CAPTURE_QUAD,        // texture, then x, y, u, v, color of every vertex
+    O2D_CAPTURE_SPRITE,      // texture, x, y, width, height, angle, uvRect, color
+    O2D_CAPTURE_SPRITE_MESH, // pointNum, texture, the quad like O2D_CAPTURE_QUAD, then the points
+    O2D_CAPTURE_TEXTURE,     // texture, width, height, hasData, then the raw RGBA8 pixels if any
+    O2D_CAPTURE_CAMERA,
+    O2D_CAPTURE_TINT,
+    O2D_CAPTURE_ALPHA_TEST,
+    O2D_CAPTURE_BLENDING,
+    O2D_CAPTURE_CLEAR_COLOR,
+    O2D_CAPTURE_DEPTH_SORTING,
+    O2D_CAPTURE_SUBMIT_MODE,
+    O2D_CAPTURE_TRIANGLE,    // texture, then x, y, u, v, color of every vertex
+    O2D_CAPTURE_OP_NUM,
 };
 
 typedef struct O2D_Vertex_t {
     float x, y; // Position
     float u, v; // Texture Coords
     float textureSlot;
+    float z; // Depth, set by O2D from the push order
+    uint32_t color; // RGBA8, red in the lowest byte. Multiplies the texture, see O2D_PackColor()
 } O2D_Vertex;
 
 typedef O2D_Vertex O2D_Quad[4];
 
+// Convex outline of the visible pixels of an image region. Points are normalized to the
+// region, s along u and t along v like the UVs of an O2D_Quad
+typedef struct O2D_SpriteMesh_t {
+    float points[O2D_MAX_MESH_POINTS][2];
+    uint8_t pointNum; // 0 if the region has no visible pixels
+} O2D_SpriteMesh;
+
+typedef struct O2D_Sprite_t {
+    float x, y; // Center
+    float width, height;
+    float angle;     // Radians
+    float uvRect[4]; // u0, v0, u1, v1, from 0 to 1. (0, 0, 1, 1) maps like O2D_MakeRect()
+    float color[4];  // Multiplies the texture
+} O2D_Sprite;
+
+// What O2D_PushSprite() uploads, the GPU expands it into 6 vertices. Mirrors the std430
+// struct in the sprite vertex shader, so only 4 byte members
+typedef struct O2D_SpriteRecord_t {
+    float x, y;
+    float width, height;
+    float angle;
+    uint32_t uvRect[2];  // Four unorm16, u0 v0 in the first
+    uint32_t color;      // RGBA8
+    uint32_t textureSlot;
+    float depth;
+} O2D_SpriteRecord;
+
+// How the capacity of a buffer follows its use, see O2D_SetBufferPolicy()
+typedef struct O2D_BufferPolicy_t {
+    float growth;         // Capacity is the required size times this when a buffer grows or shrinks
+    uint32_t decayFrames; // Submissions using at most half of a buffer before it shrinks, 0 never shrinks
+    uint32_t maxVertices; // GPU vertex buffer cap (a multiple of 6), bigger frames are drawn in chunks
+    bool elideUploads;    // See O2D_EnableUploadElision()
+} O2D_BufferPolicy;
+
+// What a pass last uploaded into the GPU buffers, so an identical one can skip its upload
+typedef struct O2D_ResidentPass_t {
+    uint64_t vertexHash;
+    uint32_t vertexBase, vertexNum;
+    uint64_t spriteHash;
+    uint32_t spriteBase, spriteNum;
+} O2D_ResidentPass;
+
+typedef struct O2D_BufferUsage_t {
+    uint32_t quietFrames; // Consecutive submissions using at most half the capacity
+    uint32_t quietPeak;   // Most used during them
+} O2D_BufferUsage;
+
+typedef struct O2D_SpriteBuffer_t {
+    O2D_SpriteRecord *sprites;
+    uint32_t number;
+    uint32_t capacity;
+    O2D_BufferUsage usage;
+} O2D_SpriteBuffer;
+
 typedef struct O2D_VertexBuffer_t {
     O2D_Vertex *vertices;
     uint32_t number;
-    uint32_t maxNumber; // The VBO capacity basically
     uint32_t capacity;
-} O2D_VertexBuffer; 
+    O2D_BufferUsage usage;
+} O2D_VertexBuffer;
 
 typedef struct O2D_TextureSlotBuffer_t {
     int32_t slots[O2D_MAX_TEX_SLOTS]; // Replica of the sampler2D array from the shader
                                       // Used for reusing texture slots where possible
     int32_t capacity;                 // Maximum capacity on device
+    uint16_t slotNum;                 // Slots per batch, min(capacity, O2D_MAX_TEX_SLOTS)
     uint16_t usedSlots;               // Occupied slots more precisely
 } O2D_TextureSlotBuffer;
 
+// Describes a generated shader
+typedef struct O2D_ShaderFeatures_t {
+    uint8_t slotNum;      // Size of the sampler array
+    uint8_t vertexFormat; // O2D_VERTEX_FORMAT_*
+    uint8_t flags;        // O2D_SHADER_*
+} O2D_ShaderFeatures;
+
+typedef struct O2D_ShaderVariant_t {
+    O2D_ShaderFeatures features;
+    uint32_t cacheIndex;
+    uint32_t program; // 0 until the variant is first used
+    int32_t viewProjLocation;
+    int32_t tintLocation;
+    int32_t alphaThresholdLocation;
+    // Uniform values last uploaded to the program
+    bool uniformsValid;
+    float viewProj[16];
+    float tint[4];
+    float alphaThreshold;
+} O2D_ShaderVariant;
+
+// Mirror of the GL state O2D touches, so that only real changes reach the driver.
+// Every field is all ones when unknown
+typedef struct O2D_StateCache_t {
+    uint32_t program;
+    uint32_t vertexArray;
+    uint32_t arrayBuffer;
+    uint32_t textures[O2D_MAX_TEX_SLOTS];
+    int8_t blending;
+    int8_t depthTest;
+    int8_t depthWrite;
+} O2D_StateCache;
+
+// Pipeline state a batch is drawn with
+typedef struct O2D_RenderState_t {
+    float tint[4];
+    float alphaThreshold; // 0 disables the alpha test
+    bool blending;
+    // Set when the batch is closed
+    uint8_t vertexFormat; // Stream the vertices come from, O2D_VERTEX_FORMAT_*
+    bool depthTest;
+    bool depthWrite;
+} O2D_RenderState;
+
+typedef struct O2D_FrameStats_t {
+    uint64_t frameIndex;
+    uint64_t beginTime; // Nanoseconds, on the _O2D_GetTimeNs() clock
+    double cpuTime;   // Time between O2D_Begin() and the swap in O2D_End() (milliseconds)
+    double frameTime; // Time between the last two O2D_End() calls (milliseconds)
+    uint32_t batchNum;
+    uint32_t vertexNum;
+    uint64_t uploadedBytes;
+    // Of uploadedBytes, not uploaded because the GPU buffers held them already (see
+    // O2D_EnableUploadElision()). With a render thread those of the previous frame's submission
+    uint64_t elidedBytes;
+    // With O2D_EnableDirtyRects(), the pixels cleared and redrawn. With a render thread those of
+    // the previous frame's submission
+    uint64_t redrawnPixels;
+    // Heap allocations O2D made during the frame. With a render thread those of the previous
+    // frame's submission are included
+    uint32_t allocationNum;
+    // GPU timings arrive a few frames late, gpuFrameIndex tells which frame they belong to
+    uint64_t gpuFrameIndex;
+    double gpuTime;   // Milliseconds, 0 if no results have been read back yet
+    uint32_t timedBatchNum;
+    double gpuBatchTimes[O2D_MAX_TIMED_BATCHES];
+} O2D_FrameStats;
+
+typedef struct O2D_GpuTimerFrame_t {
+    uint32_t queries[2 + 2 * O2D_MAX_TIMED_BATCHES]; // Frame begin/end, then begin/end of every batch
+    uint32_t batchNum;
+    uint64_t frameIndex;
+    bool open;    // Between O2D_Begin() and O2D_End()
+    bool pending; // Waiting to be read back
+} O2D_GpuTimerFrame;
+
+typedef struct O2D_GpuTimers_t {
+    O2D_GpuTimerFrame frames[O2D_GPU_TIMER_FRAMES];
+    uint32_t current;
+    uint32_t droppedFrames; // Frames whose results were not ready when their slot got reused
+    bool created;
+    // Latest results read back
+    uint64_t resultFrameIndex;
+    double resultTime;
+    uint32_t resultBatchNum;
+    double resultBatchTimes[O2D_MAX_TIMED_BATCHES];
+} O2D_GpuTimers;
+
+typedef struct O2D_OverdrawReport_t {
+    uint64_t frameIndex;
+    // Pixels shaded 0, 1, 2... times in the frame, the last bucket also counts anything above
+    uint32_t histogram[O2D_OVERDRAW_BUCKETS];
+    uint32_t peak;        // Highest count of a single pixel
+    double average;       // Fragments per pixel that was shaded at least once
+    uint64_t fragmentNum;
+    uint32_t heatmap;     // RGBA8 texture the size of the framebuffer, bottom row first. 0 until the first report
+    uint16_t width, height;
+} O2D_OverdrawReport;
+
+typedef struct O2D_OverdrawProfiler_t {
+    bool active; // The frame being drawn counts its fragments
+    uint32_t counterTexture; // R32UI
+    uint16_t width, height;
+    uint32_t *counts;  // Read back from counterTexture
+    uint8_t *pixels;   // Of the heatmap
+    O2D_OverdrawReport result; // Written by the thread drawing, copied to the renderer at the end of the frame
+} O2D_OverdrawProfiler;
+
+typedef struct O2D_FlightRecorder_t {
+    O2D_FrameStats *frames; // Ring of the last O2D_FLIGHT_RECORDER_FRAMES frames
+    uint32_t head;
+    uint32_t frameNum;
+    double threshold; // Frame time that triggers a dump (milliseconds)
+    char pathPrefix[256];
+    uint32_t dumpNum;
+} O2D_FlightRecorder;
+
+typedef struct O2D_ReplayStats_t {
+    uint64_t frameNum;
+    uint64_t callNum;
+    double time; // Milliseconds, from the first call to the last
+} O2D_ReplayStats;
+
+// Memory callbacks, see O2D_SetAllocator(). reallocate allocates when ptr is NULL, size is never 0
+typedef struct O2D_Allocator_t {
+    void *(*reallocate)(void *user, void *ptr, size_t size);
+    void (*release)(void *user, void *ptr);
+    void *user;
+} O2D_Allocator;
+
+// Linear allocator for memory that only lives until the next O2D_Begin()
+typedef struct O2D_FrameArena_t {
+    uint8_t *memory;
+    size_t capacity;
+    size_t used;
+    size_t requested; // This frame, including what didn't fit
+    void **overflow;  // Blocks allocated when memory ran out, folded into it by the next reset
+    uint32_t overflowNum;
+    uint32_t overflowCapacity;
+} O2D_FrameArena;
+
+typedef struct O2D_FrameLimiter_t {
+    uint64_t targetTime; // Nanoseconds per frame, 0 when disabled
+    uint64_t spinTime;   // The last part of every wait is spun instead of slept
+    uint64_t deadline;
+} O2D_FrameLimiter;
+
+typedef struct O2D_FrameClock_t {
+    uint64_t startTime; // Nanoseconds, on the _O2D_GetTimeNs() clock
+    uint64_t lastTime;
+    uint64_t deltaTime; // Duration of the last frame
+    uint64_t elapsed;   // Since O2D_FrameClockStart()
+} O2D_FrameClock;
+
+typedef struct O2D_FixedTimestep_t {
+    uint64_t step;        // Nanoseconds
+    uint64_t accumulator;
+    uint32_t maxSteps;    // Per frame, the time of any further step is dropped
+    uint32_t stepNum;     // Steps taken since the last O2D_FixedTimestepAdvance()
+} O2D_FixedTimestep;
+
+typedef struct O2D_Batch_t {
+    uint32_t firstVertex; // In the stream of state.vertexFormat, a sprite counts as 6 vertices
+    uint32_t vertexNum;
+    uint32_t textures[O2D_MAX_TEX_SLOTS]; // Texture bound to every slot while drawing
+    uint16_t usedSlots;
+    O2D_RenderState state;
+} O2D_Batch;
+
+// Geometry recorded for one pass. Batches are closed as it is recorded, the open one lives
+// in vtxBuf or spriteBuf (see vertexFormat) from batchFirstVertex on, and in textureSlots
+typedef struct O2D_BatchStream_t {
+    O2D_VertexBuffer vtxBuf;
+    O2D_SpriteBuffer spriteBuf;
+    O2D_TextureSlotBuffer textureSlots;
+    uint8_t vertexFormat;
+    uint32_t batchFirstVertex;
+    O2D_Batch *batches;
+    uint32_t batchNum;
+    uint32_t batchCapacity;
+} O2D_BatchStream;
+
+// Layout of the std430 struct the bindless shader reads with the draw index
+typedef struct O2D_DrawParams_t {
+    float tint[4];
+    float alphaThreshold;
+    uint32_t firstTexture; // Index of the draw's first handle in the texture table
+    uint32_t textureNum;
+    uint32_t padding;
+} O2D_DrawParams;
+
+typedef struct O2D_DrawArraysIndirectCommand_t {
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t first;
+    uint32_t baseInstance; // Index of the draw in the whole frame, see O2D_SHADER_BINDLESS
+} O2D_DrawArraysIndirectCommand;
+
+typedef struct O2D_StreamRing_t {
+    uint32_t buffer; // O2D_STREAM_CHUNK_NUM chunks of O2D_STREAM_CHUNK_SIZE bytes
+    uint32_t VAO;    // Reads the vertices from the chunk bound to it
+    GLsync fences[O2D_STREAM_CHUNK_NUM]; // Signaled when the draws reading a chunk are done
+    uint32_t nextChunk;
+} O2D_StreamRing;
+
+// Offscreen framebuffer of O2D_EnableDirtyRects() and what it holds
+typedef struct O2D_DirtyTracker_t {
+    uint32_t framebuffer;
+    uint32_t colorBuffer;
+    uint32_t depthStencilBuffer; // The stencil marks the rectangles being redrawn
+    uint16_t width, height;
+    bool valid;   // The framebuffer holds the frame described below
+    bool pending; // Without a render thread: the frame began and nothing was drawn into it yet
+    O2D_BatchStream previous[O2D_PASS_NUM]; // Copy of the last frame drawn
+    float viewProj[16];
+    float clearColor[4];
+    bool depthSorting;
+    int32_t rects[O2D_MAX_DIRTY_RECTS][4]; // Pixels x0, y0, x1, y1 from the bottom left, x1 and y1 excluded
+    uint32_t rectNum;
+    uint64_t redrawnPixels;
+} O2D_DirtyTracker;
+
+typedef struct O2D_IndirectSubmit_t {
+    bool supported; // GL_ARB_bindless_texture and GL_ARB_shader_draw_parameters are available
+    uint32_t commandBuffer;
+    uint32_t drawParamBuffer;
+    uint32_t textureTableBuffer;
+    uint64_t *textureHandles; // Resident handle of every texture used so far, indexed by texture name
+    uint32_t textureHandleCapacity;
+    // Contents of the buffers above, rebuilt every frame
+    O2D_DrawArraysIndirectCommand *commands;
+    O2D_DrawParams *drawParams;
+    uint64_t *textureTable;
+    const O2D_Batch **batches; // Of every draw, across the passes
+    uint32_t drawCapacity;
+} O2D_IndirectSubmit;
+
+typedef struct O2D_ProgramCacheEntry_t {
+    uint64_t hash;  // Of the shader sources
+    uint32_t program;
+    uint32_t vertexShader, fragmentShader; // Only while the program is being compiled
+    bool pending;   // Compile and link were issued but their result hasn't been checked
+    bool fromDisk;
+} O2D_ProgramCacheEntry;
+
+typedef struct O2D_ProgramCache_t {
+    O2D_ProgramCacheEntry *entries;
+    uint32_t entryNum;
+    uint32_t entryCapacity;
+    uint64_t driverHash; // Binaries are only valid for the driver that produced them
+    bool parallelCompile; // GL_KHR_parallel_shader_compile is available
+} O2D_ProgramCache;
+
+// Owned by the renderer when O2D_StartRenderThread() succeeds
+struct O2D_RenderThread_t;
+
 typedef struct O2D_Renderer_t {
     GLFWwindow *window;
     uint16_t width, height;
+    uint16_t framebufferWidth, framebufferHeight;
     float cameraX, cameraY;
-    O2D_VertexBuffer vtxBuf;
+    O2D_BatchStream streams[O2D_PASS_NUM];
     uint32_t VAO;
     uint32_t VBO;
+    uint32_t vboCapacity; // Vertices
+    O2D_BufferUsage vboUsage;
+    uint32_t spriteVAO;   // No attributes, the sprite shaders read spriteSSBO
+    uint32_t spriteSSBO;
+    uint32_t spriteSSBOCapacity; // Sprites
+    O2D_BufferUsage spriteSSBOUsage;
+    O2D_BufferPolicy bufferPolicy;
+    O2D_ResidentPass resident[O2D_PASS_NUM];
     uint32_t shader;
     int32_t projectionMatrixUniformLocation;
     float viewProjMatrix[16];
-    O2D_TextureSlotBuffer textureSlots;
+    uint64_t frameIndex;
+    uint64_t frameBeginTime; // Nanoseconds
+    uint64_t frameEndTime;
+    O2D_FrameStats stats;     // Statistics of the frame being recorded
+    O2D_FrameStats lastStats; // Statistics of the last finished frame
+    O2D_GpuTimers gpuTimers;       // Used by the thread that submits
+    O2D_OverdrawProfiler overdraw; // Used by the thread that submits
+    // Set by O2D_EnableGpuTimers() and O2D_EnableOverdrawProfiling(), take effect when the next frame is submitted
+    bool gpuTiming;
+    bool overdrawProfiling;
+    O2D_OverdrawReport overdrawReport; // Of the last finished frame
+    O2D_FlightRecorder flightRecorder;
+    O2D_FrameLimiter frameLimiter;
+    int32_t swapInterval;
+    int32_t defaultSwapInterval; // The driver's at start-up, applied when a replay puts swapInterval back to -1
+    float clearColor[4];
+    struct O2D_RenderThread_t *renderThread;
+    O2D_ProgramCache programCache;
+    O2D_ShaderVariant shaderVariants[O2D_MAX_SHADER_VARIANTS];
+    uint32_t shaderVariantNum;
+    O2D_RenderState state;
+    O2D_StateCache stateCache;
+    // Camera and size viewProjMatrix was computed for
+    bool viewProjValid;
+    float viewProjCamera[2];
+    uint16_t viewProjSize[2];
+    uint8_t submitMode; // O2D_SUBMIT_*
+    O2D_IndirectSubmit indirect;
+    O2D_StreamRing streamRing;
+    uint32_t sealVertexNum; // Ordered vertices that fill a streaming chunk, UINT32_MAX when not streaming
+    bool dirtyRects;
+    O2D_DirtyTracker dirty; // Used by the thread that submits
+    bool depthSorting;
+    uint32_t depthCounter; // Primitives pushed this frame
+    O2D_FrameArena frameArena;
+    bool onDemand; // O2D_RunOnDemand() polls the events instead of O2D_End()
+    uint64_t frameAllocationBase; // Allocations the recording thread had made when the frame began
+    bool allocationCheck;
 } O2D_Renderer;
 
 typedef struct O2D_Animation_t {
@@ -65,6 +506,10 @@ typedef struct O2D_Animation_t {
     float timer; // Internal clock
 } O2D_Animation;
 
+// Sets the directory where linked shader programs are cached between runs. Affects renderers
+// created afterwards. The directory must exist. NULL (the default) disables the disk cache
+void O2D_SetShaderCacheDirectory(const char *directory);
+
 // Initializes the renderer with basic window info
 bool O2D_Create(O2D_Renderer* renderer, const char* title, uint32_t width, uint32_t height);
 
@@ -74,24 +519,124 @@ void O2D_Terminate(O2D_Renderer* renderer);
 // Should be called before pushing any geometry to the batch. Cleans the batch
 void O2D_Begin(O2D_Renderer* renderer);
 
-// Renders the batch and polls events. Should be called at the end of the frame
+// Renders the batch and polls events (unless O2D_RunOnDemand() does). Should be called at the end of the frame
 void O2D_End(O2D_Renderer* renderer);
 
-// Renders the batch. Should be called at the end of the frame
+// Uploads everything pushed so far at once and draws it with one call per batch. O2D_End()
+// calls it, so it is only needed to flush mid-frame
 void O2D_RenderBatch(O2D_Renderer* renderer);
 
 // Clears the batch
 void O2D_ClearBatch(O2D_Renderer* renderer);
 
+// Sets the color the frame is cleared with in O2D_Begin()
+void O2D_SetClearColor(O2D_Renderer* renderer, float r, float g, float b, float a);
+
+// Moves the GL context to a render thread. O2D_End() then hands the recorded frame to that
+// thread and returns after polling events, so frame N + 1 is recorded while frame N is being
+// submitted. The calling thread keeps a hidden context sharing objects with the window, so
+// O2D_CreateTexture() still works from it, but no other GL calls should be made
+bool O2D_StartRenderThread(O2D_Renderer* renderer);
+
+// Waits for the render thread to finish and makes the context current on the calling thread again
+void O2D_StopRenderThread(O2D_Renderer* renderer);
+
+// Multiplies everything pushed afterwards by (r, g, b, a)
+void O2D_SetTint(O2D_Renderer* renderer, float r, float g, float b, float a);
+
+// Discards fragments with an alpha lower than threshold for everything pushed afterwards.
+// 0 disables the test
+void O2D_SetAlphaTest(O2D_Renderer* renderer, float threshold);
+
+// Enables or disables alpha blending for everything pushed afterwards
+void O2D_SetBlending(O2D_Renderer* renderer, bool enable);
+
+// Moves the camera to (x, y)
+void O2D_SetCamera(O2D_Renderer* renderer, float x, float y);
+
+// Chooses how batches are turned into draw calls (O2D_SUBMIT_*). O2D_SUBMIT_MULTI_DRAW_INDIRECT
+// needs GL_ARB_bindless_texture and GL_ARB_shader_draw_parameters, returns false and keeps the
+// current mode if they are missing.
+// O2D_SUBMIT_STREAMING seals the frame into chunks of O2D_STREAM_CHUNK_SIZE bytes while it is
+// pushed and draws each one right away, so the GPU starts on the frame before O2D_End(). The
+// batches of a chunk use the camera set when it is sealed. Without a render thread and depth
+// sorting only, otherwise it submits like O2D_SUBMIT_DRAW_ARRAYS
+bool O2D_SetSubmitMode(O2D_Renderer* renderer, uint8_t mode);
+
+// Gives everything pushed a depth from the push order and draws opaque geometry (opaque
+// textures with full alpha, or blending disabled) first, front to back, writing depth and
+// without blending. The rest is drawn afterwards in push order, depth tested against it.
+// Needs a depth buffer
+void O2D_SetDepthSorting(O2D_Renderer* renderer, bool enable);
+
+// Forgets the cached GL state. Must be called after making GL calls that change the bound
+// program, vertex array, array buffer, texture units, blending or depth state behind O2D's back.
+// The render thread owns the GL state while it runs, so this fails unless it is stopped
+void O2D_ResetStateCache(O2D_Renderer* renderer);
+
 // Returns true if the created window is open, false otherwise
 bool O2D_WindowIsOpen(O2D_Renderer* renderer);
 
-// Pushes quad to batch. Should be called between O2D_Begin() and O2D_End()
-// calls as it may break up the batch and render it partially
-void O2D_PushQuad(O2D_Renderer* renderer, O2D_Quad quad, uint32_t texture);
+// Pushes a frame for O2D_RunOnDemand(), which calls O2D_Begin() and O2D_End() around it. Returns
+// true while an animation runs, so the next frame is drawn without waiting for events
+typedef bool (*O2D_DrawFunction)(O2D_Renderer* renderer, void *user);
+
+// Runs the frame loop until the window closes, for tools and dashboards that are mostly idle.
+// After a frame where draw returned false it sleeps in glfwWaitEvents() and the last frame stays
+// on screen. Input and other window events, O2D_Invalidate() or maxIdle seconds passing (0 never)
+// wake it up to draw the next one. Frames can be far apart, so animations should be timed with
+// a clock of their own
+void O2D_RunOnDemand(O2D_Renderer* renderer, O2D_DrawFunction draw, void *user, double maxIdle);
+
+// Makes O2D_RunOnDemand() draw a frame, e.g. when the data it shows changed. Can be called from
+// any thread
+void O2D_Invalidate(O2D_Renderer* renderer);
+
+// Pushes quad to batch. Should be called between O2D_Begin() and O2D_End() calls.
+// When the texture slots run out a new batch is started in the same vertex stream.
+// Inline: appending to the open batch is done in the caller, see _O2D_PushQuadSlow()
+static inline void O2D_PushQuad(O2D_Renderer* renderer, const O2D_Quad quad, uint32_t texture);
+
+// O2D_PushQuad() with the colors of quad multiplied by tint (RGBA8, see O2D_PackColor())
+void O2D_PushQuadTinted(O2D_Renderer* renderer, const O2D_Quad quad, uint32_t texture, uint32_t tint);
+
+// Pushes quad untextured in a single color. Shares the batch with textured quads, it doesn't
+// take a texture slot
+void O2D_PushColoredQuad(O2D_Renderer* renderer, const O2D_Quad quad, uint32_t color);
+
+// Pushes a triangle with the positions, texture coordinates and colors of its vertices.
+// O2D_NO_TEXTURE draws it untextured
+void O2D_PushTriangle(O2D_Renderer* renderer, const O2D_Vertex triangle[3], uint32_t texture);
+
+// Pushes quadNum quads with the same texture, 4 vertices each in O2D_Quad order. The texture
+// slot is resolved and the vertex buffer grown once for all of them
+void O2D_PushQuads(O2D_Renderer* renderer, const O2D_Vertex *vertices, uint32_t quadNum, uint32_t texture);
+
+// Pushes quadNum quads, 4 vertices each, quad i with textures[i]. The texture slot is resolved
+// once per run of quads with the same texture
+void O2D_PushQuadsMixed(O2D_Renderer* renderer, const O2D_Vertex *vertices, const uint32_t *textures, uint32_t quadNum);
+
+// Pushes a sprite record to the batch. The vertex shader expands it, so it uploads about a
+// third of what O2D_PushQuad() does. Switching between sprites and quads starts a new batch
+void O2D_PushSprite(O2D_Renderer* renderer, const O2D_Sprite *sprite, uint32_t texture);
 
-// Initializes O2D_Quad as a rectangle (supports rotation)
-void O2D_MakeRect(O2D_Quad quad, float x, float y, float width, float height, float angle);
+// Builds a convex polygon of at most maxPoints (3 to O2D_MAX_MESH_POINTS) points around the
+// pixels with an alpha above alphaThreshold in the region (x, y, width, height, NULL for the
+// whole image) of a 4 channel image. The polygon never cuts off a visible pixel, including the
+// texels linear filtering blends in, and never leaves the region. Returns false, with no points,
+// if the region is empty, not inside the image or has no visible pixels
+bool O2D_BuildSpriteMesh(O2D_SpriteMesh *mesh, const uint8_t *imageData, int32_t width, int32_t height,
+                         const int32_t region[4], uint8_t alphaThreshold, uint8_t maxPoints);
+
+// Pushes the part of quad covered by mesh as a triangle fan, so the transparent padding around
+// a sprite isn't rasterized. quad is used like in O2D_PushQuad(), its corners span the mesh region
+void O2D_PushSpriteMesh(O2D_Renderer* renderer, const O2D_SpriteMesh *mesh, const O2D_Quad quad, uint32_t texture);
+
+// Initializes O2D_Quad as a white rectangle (supports rotation). Inline
+static inline void O2D_MakeRect(O2D_Quad quad, float x, float y, float width, float height, float angle);
+
+// Packs a color for O2D_Vertex and O2D_PushQuadTinted(). Components are clamped to 0 to 1. Inline
+static inline uint32_t O2D_PackColor(float r, float g, float b, float a);
 
 // Creates a OpenGL texture. Must have 4 channels
 uint32_t O2D_CreateTexture(uint8_t *textureData, int32_t width, int32_t height);
@@ -108,27 +653,212 @@ void O2D_PushAnimationFrame(O2D_Renderer* renderer, O2D_Animation *animation, O2
 // Sets animation timer and frameIndex to 0
 void O2D_ResetAnimation(O2D_Animation *animation);
 
-// Utility: Grows the vertex buffer capacity if necessary
-void _O2D_EnsureVtxBufSize(O2D_Renderer* renderer, uint32_t requiredCapacity);
+// Enables or disables the GPU timestamp queries around every batch. Results are read back
+// O2D_GPU_TIMER_FRAMES frames later, so they never stall the pipeline
+void O2D_EnableGpuTimers(O2D_Renderer* renderer, bool enable);
+
+// Returns the statistics of the last finished frame
+const O2D_FrameStats *O2D_GetFrameStats(O2D_Renderer* renderer);
+
+// Draws with shader variants that count the fragments shaded on every pixel, reading the
+// counts back after each frame. This stalls the pipeline, so it is meant for debugging only
+void O2D_EnableOverdrawProfiling(O2D_Renderer* renderer, bool enable);
+
+// Returns the overdraw of the last profiled frame. Its heatmap texture can be pushed like any other
+const O2D_OverdrawReport *O2D_GetOverdrawReport(O2D_Renderer* renderer);
+
+// Keeps the stats of the last O2D_FLIGHT_RECORDER_FRAMES frames and, when a frame takes longer
+// than threshold (milliseconds), writes them together with the trace events of that window to
+// "<pathPrefix>_<frameIndex>.json". At most O2D_FLIGHT_RECORDER_MAX_DUMPS files are written
+void O2D_EnableFlightRecorder(O2D_Renderer* renderer, double threshold, const char *pathPrefix);
+
+// Stops the flight recorder and frees its window
+void O2D_DisableFlightRecorder(O2D_Renderer* renderer);
+
+// Records every drawing call made from now on (frames, pushes, render state, camera and texture
+// creation) into a compact binary log at path. Textures created before the capture are read back
+// and recorded the first time they are drawn. Should be called between frames
+bool O2D_StartCapture(O2D_Renderer* renderer, const char *path);
+
+// Finishes the running capture. Returns false if the log couldn't be written completely
+bool O2D_StopCapture(void);
+
+// Plays a capture back on renderer repeatNum times, as fast as possible: the window is hidden,
+// vsync and the frame limiter are off while it runs. Textures are recreated once and their names
+// remapped. The render state the capture leaves behind stays set. stats can be NULL
+bool O2D_Replay(O2D_Renderer* renderer, const char *path, uint32_t repeatNum, O2D_ReplayStats *stats);
+
+// Routes every allocation O2D makes through allocator, NULL restores malloc/realloc/free.
+// Memory is freed with the allocator that was set when it was allocated, so this should be
+// called before anything is created
+void O2D_SetAllocator(const O2D_Allocator *allocator);
+
+// Returns size bytes, aligned to O2D_FRAME_ARENA_ALIGNMENT, that stay valid until the next
+// O2D_Begin(). Meant for transient per frame data such as sort keys, command lists and
+// culling scratch space. The arena grows to fit the busiest frame, so it stops allocating
+void *O2D_FrameAlloc(O2D_Renderer* renderer, size_t size);
+
+// Hashes the vertices and sprites of every pass when they are submitted and skips uploading
+// the passes the GPU buffers hold already, e.g. in menus and paused scenes that repeat the same
+// frame. Costs a read of the submitted data, so it is off by default. Streamed and chunked
+// submissions always upload
+void O2D_EnableUploadElision(O2D_Renderer* renderer, bool enable);
+
+// Draws frames into an offscreen framebuffer that keeps its contents, and only clears and redraws
+// the rectangles around primitives that changed (or went away) since the previous frame, before
+// copying it to the window. Meant for UI-like scenes where little changes from frame to frame.
+// Primitives are matched by content in push order, so pushing or removing a few only redraws
+// those. More than O2D_DIRTY_LOOKAHEAD in a row redraw every primitive after them. With depth
+// sorting, every push after an inserted or removed one gets another depth and is redrawn too.
+// Moving the camera, resizing, changing the clear color or depth sorting, and frames submitted in
+// parts (O2D_RenderBatch() before O2D_End()) redraw everything. Call between frames. Turns
+// O2D_SUBMIT_STREAMING into O2D_SUBMIT_DRAW_ARRAYS, which needs no whole frame
+void O2D_EnableDirtyRects(O2D_Renderer* renderer, bool enable);
+
+// Reports every frame that makes a heap allocation, and asserts unless NDEBUG is defined. Buffers
+// grow during the first frames, so it is meant to be enabled once a scene reached its steady state
+void O2D_EnableAllocationCheck(O2D_Renderer* renderer, bool enable);
+
+// Sets how the vertex and sprite buffers, on the CPU and the GPU, follow the frames' needs.
+// Growing buffers get growth (at least 1, where 1 reallocates on every push past the end) times
+// the required size. After decayFrames submissions in a row using at most half of a buffer, it
+// shrinks to growth times the most they used (0 never shrinks). The GPU vertex buffer holds at most maxVertices vertices
+// (maxVertices / 6 sprites), bigger frames are uploaded and drawn in chunks of that size.
+// 0 removes the cap. Defaults: 1.5, O2D_DEFAULT_BUFFER_DECAY_FRAMES, O2D_DEFAULT_MAX_BUFFER_VERTICES
+void O2D_SetBufferPolicy(O2D_Renderer* renderer, float growth, uint32_t decayFrames, uint32_t maxVertices);
+
+// Sets the number of screen refreshes to wait for before swapping (0 disables vsync)
+void O2D_SetSwapInterval(O2D_Renderer* renderer, int32_t interval);
+
+// Limits the frame rate by waiting in O2D_End() before the swap. Sleeps for most of the wait
+// and spins for the last part so the target is hit precisely. 0 disables the limiter
+void O2D_SetFrameLimit(O2D_Renderer* renderer, double framesPerSecond);
+
+// Starts the frame clock
+void O2D_FrameClockStart(O2D_FrameClock *clock);
+
+// Measures the time since the last tick. Should be called once per frame
+void O2D_FrameClockTick(O2D_FrameClock *clock);
+
+// Returns the duration of the last frame in milliseconds
+double O2D_FrameClockDelta(const O2D_FrameClock *clock);
+
+// Initializes a fixed timestep accumulator. Note: step is in milliseconds. Returns false if step
+// isn't positive, the accumulator then never steps
+bool O2D_FixedTimestepInit(O2D_FixedTimestep *timestep, double step, uint32_t maxSteps);
+
+// Adds the frame time (nanoseconds) to the accumulator
+void O2D_FixedTimestepAdvance(O2D_FixedTimestep *timestep, uint64_t deltaTime);
+
+// Returns true while there is a whole step left to simulate, consuming it
+bool O2D_FixedTimestepStep(O2D_FixedTimestep *timestep);
+
+// Returns how far (0 to 1) the accumulator is into the next step, for interpolating rendering
+double O2D_FixedTimestepAlpha(const O2D_FixedTimestep *timestep);
+
+// Writes the trace events of every thread to path in the Chrome/Perfetto trace JSON format.
+// Returns false if tracing is disabled or the file can't be written
+bool O2D_TraceDump(const char *path);
+
+// Used by the inline fast paths below, the other utilities are declared in src/o2d_internal.h
+
+// Utility: Returns the slot of texture in the open batch, -1 if it has none. Inline
+static inline int16_t _O2D_FindTextureSlot(const O2D_BatchStream *stream, uint32_t texture);
+
+// Utility: Returns the depth of the next primitive, nearer than everything pushed before. Inline
+static inline float _O2D_NextDepth(O2D_Renderer* renderer);
+
+// Utility: O2D_PushQuad() for everything but appending to the open batch of the ordered pass
+void _O2D_PushQuadSlow(O2D_Renderer* renderer, const O2D_Quad quad, uint32_t texture);
+
+// Utility: Writes the two triangles of quad to vertices. Inline
+static inline void _O2D_WriteQuadVertices(O2D_Vertex *vertices, const O2D_Quad quad, int16_t texSlot, float z);
+
+// Set while a capture runs, the inline fast paths leave captured pushes to o2d.c
+extern FILE *_O2D_captureFile;
+
+// Inline fast paths. They only use what C and C++ have in common, so the header stays usable
+// from both
+
+static inline int16_t _O2D_FindTextureSlot(const O2D_BatchStream *stream, uint32_t texture) {
+    if (texture == O2D_NO_TEXTURE)
+        return O2D_WHITE_SLOT;
+    for (int16_t i = 0; i < stream->textureSlots.usedSlots; i++) {
+        if (stream->textureSlots.slots[i] == (int32_t)texture)
+            return i;
+    }
+    return -1;
+}
 
-// Utility: Compiles the hard-coded shaders
-void _O2D_CreateShaders(O2D_Renderer* renderer);
+static inline float _O2D_NextDepth(O2D_Renderer* renderer) {
+    if (renderer->depthCounter < O2D_MAX_DEPTH_STEPS)
+        renderer->depthCounter++;
+    return (float)renderer->depthCounter / O2D_MAX_DEPTH_STEPS;
+}
 
-// Utility: Updates the projection matrix and the shader uniform
-void _O2D_UpdateViewProjMatrix(O2D_Renderer* renderer);
+static inline void _O2D_WriteQuadVertices(O2D_Vertex *vertices, const O2D_Quad quad, int16_t texSlot, float z) {
+    static const uint8_t corners[6] = { 0, 1, 2, 0, 2, 3 };
+    for (uint8_t i = 0; i < 6; i++) {
+        vertices[i] = quad[corners[i]];
+        vertices[i].textureSlot = texSlot;
+        vertices[i].z = z;
+    }
+}
 
-// Utility: Translates mat by (dx, dy, 0). Note: dx and dy are in world space, not screen space
-void _O2D_TranslateMatrix(O2D_Renderer* renderer, float mat[16], float dx, float dy);
+static inline void O2D_PushQuad(O2D_Renderer* renderer, const O2D_Quad quad, uint32_t texture) {
+    O2D_BatchStream *stream = &renderer->streams[O2D_PASS_ORDERED];
+    O2D_VertexBuffer *vtxBuf = &stream->vtxBuf;
+    int16_t texSlot = -1;
+    if (renderer->depthSorting || _O2D_captureFile != NULL || stream->vertexFormat != O2D_VERTEX_FORMAT_BATCH ||
+        vtxBuf->number + 6 > vtxBuf->capacity || vtxBuf->number + 6 > renderer->sealVertexNum ||
+        (texSlot = _O2D_FindTextureSlot(stream, texture)) < 0) {
+        _O2D_PushQuadSlow(renderer, quad, texture);
+    }
+    else {
+        _O2D_WriteQuadVertices(vtxBuf->vertices + vtxBuf->number, quad, texSlot, _O2D_NextDepth(renderer));
+        vtxBuf->number += 6;
+    }
+}
 
-// Utility: Rotates mat by angle (radians)
-void _O2D_RotateMatrix(float mat[16], float angle);
+static inline void O2D_MakeRect(O2D_Quad quad, float x, float y, float width, float height, float angle) {
+    // Offset from the center and texture coordinates of every corner
+    static const float corners[4][4] = { { -0.5f, -0.5f, 0.0f, 1.0f }, { -0.5f, 0.5f, 0.0f, 0.0f },
+                                         { 0.5f, 0.5f, 1.0f, 0.0f }, { 0.5f, -0.5f, 1.0f, 1.0f } };
+    float s = angle != 0.0f ? sinf(angle) : 0.0f;
+    float c = angle != 0.0f ? cosf(angle) : 1.0f;
+    for (uint8_t i = 0; i < 4; i++) {
+        float dx = corners[i][0] * width, dy = corners[i][1] * height;
+        quad[i].x = x + dx * c - dy * s;
+        quad[i].y = y + dx * s + dy * c;
+        quad[i].u = corners[i][2];
+        quad[i].v = corners[i][3];
+        quad[i].textureSlot = 0.0f;
+        quad[i].z = 0.0f;
+        quad[i].color = 0xFFFFFFFFu;
+    }
+}
 
-// Utility: Rotates point another another point (pivot) by angle (radians)
-void _O2D_RotatePoint(float *pointX, float *pointY, float pivotX, float pivotY, float angle);
+static inline uint32_t O2D_PackColor(float r, float g, float b, float a) {
+    const float components[4] = { r, g, b, a };
+    uint32_t color = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        float value = components[i] < 0.0f ? 0.0f : components[i] > 1.0f ? 1.0f : components[i];
+        color |= (uint32_t)(value * 255.0f + 0.5f) << (i * 8);
+    }
+    return color;
+}
 
 #ifdef __cplusplus
 }
 #endif
 
+// Unity build: define O2D_IMPLEMENTATION in one C (not C++) file before including o2d.h to
+// compile src/o2d.c and glad into it, so the source tree has to be next to the header. Everything
+// else includes o2d.h as usual
+#ifdef O2D_IMPLEMENTATION
+#include "../src/o2d.c"
+#include "../src/vendor/glad.c"
+#endif
+
 #endif
 
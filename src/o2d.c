@@ -1,32 +1,129 @@
-#include "../include/o2d.h"
-
-const char *_O2D_vertexShader =
-    "#version 450 core\n"
-    "layout (location = 0) in vec2 aPos;\n"
-    "layout (location = 1) in vec2 aTexCoord;\n"
-    "layout (location = 2) in float aTexSlot;\n"
-    "out vec2 oTexCoord;\n"
-    "out float oTexSlot;\n"
-    "uniform mat4 uViewProj;\n"
-    "void main() {\n"
-        "oTexCoord = aTexCoord;\n"
-        "oTexSlot = aTexSlot;\n"
-        "gl_Position = uViewProj * vec4(aPos, 1.0, 1.0);\n"
-    "}\n";
-
-const char *_O2D_fragmentShader =
-    "#version 450 core\n"
-    "out vec4 FragColor;\n"
-    "in vec2 oTexCoord;\n"
-    "in float oTexSlot;\n"
-    "uniform sampler2D uTextures[32];\n" // Supports a maximum of 32 texture slots
-    "void main() {\n"
-        "FragColor = texture(uTextures[uint(oTexSlot)], oTexCoord);\n"
-    "}\n";
+// clock_gettime() and nanosleep() are POSIX, strict C modes (-std=c11) leave them out otherwise
+#if !defined(_POSIX_C_SOURCE) && !defined(_WIN32)
+#define _POSIX_C_SOURCE 199309L
+#endif
+#include "o2d_internal.h"
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef O2D_ENABLE_TRACE
+#include <stdatomic.h>
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+// GLX_EXT_swap_control, GLX itself is not included
+#ifndef GLX_SWAP_INTERVAL_EXT
+#define GLX_SWAP_INTERVAL_EXT 0x20F1
+#endif
+typedef void (APIENTRYP O2D_PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+typedef GLuint64 (APIENTRYP O2D_PFNGLGETTEXTUREHANDLEARBPROC)(GLuint texture);
+typedef void (APIENTRYP O2D_PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)(GLuint64 handle);
+
+// GL_ARB_bindless_texture entry points, loaded by _O2D_InitIndirectSubmit()
+O2D_PFNGLGETTEXTUREHANDLEARBPROC _O2D_glGetTextureHandleARB;
+O2D_PFNGLMAKETEXTUREHANDLERESIDENTARBPROC _O2D_glMakeTextureHandleResidentARB;
+
+#if defined(_MSC_VER)
+#define O2D_THREAD_LOCAL __declspec(thread)
+#else
+#define O2D_THREAD_LOCAL _Thread_local
+#endif
+
+#ifdef O2D_ENABLE_TRACE
+typedef struct O2D_TraceRecord_t {
+    const char *name;
+    uint64_t time;
+    char phase;
+} O2D_TraceRecord;
+
+// A record in the ring. sequence is the event index + 1 once the record is complete and 0 while
+// it is being rewritten, so the reader can tell a consistent copy from a torn one
+typedef struct O2D_TraceSlot_t {
+    _Atomic uint64_t sequence;
+    _Atomic(const char *) name;
+    _Atomic uint64_t time;
+    _Atomic char phase;
+} O2D_TraceSlot;
+
+// Written by its owning thread only. head counts every event ever written, the reader
+// discards the slots the writer rewrote while it was copying them
+typedef struct O2D_TraceBuffer_t {
+    O2D_TraceSlot slots[O2D_TRACE_RING_SIZE];
+    _Atomic uint64_t head;
+    uint32_t threadId;
+} O2D_TraceBuffer;
+
+_Atomic(O2D_TraceBuffer *) _O2D_traceBuffers[O2D_TRACE_MAX_THREADS];
+_Atomic uint32_t _O2D_traceBufferNum;
+O2D_THREAD_LOCAL O2D_TraceBuffer *_O2D_threadTraceBuffer;
+O2D_THREAD_LOCAL bool _O2D_threadTraceFull;
+#endif
+
+typedef struct O2D_RenderThread_t {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    GLFWwindow *uploadWindow; // Hidden, its context stays current on the recording thread
+    // The frame being submitted, swapped with the renderer's streams in _O2D_QueueFrame()
+    O2D_BatchStream streams[O2D_PASS_NUM];
+    float viewProjMatrix[16];
+    float clearColor[4];
+    uint64_t frameIndex;
+    O2D_FrameLimiter frameLimiter;
+    int32_t swapInterval;
+    int32_t appliedSwapInterval;
+    uint8_t submitMode;
+    O2D_BufferPolicy bufferPolicy;
+    bool depthSorting;
+    bool gpuTiming;
+    bool overdrawProfiling;
+    uint16_t framebufferWidth, framebufferHeight;
+    uint16_t viewportWidth, viewportHeight;
+    uint32_t allocationNum; // Made while submitting the last frame
+    uint64_t elidedBytes;   // Not uploaded while submitting the last frame
+    bool dirtyRects;
+    bool submitted; // A frame is waiting for or being submitted
+    bool quit;
+} O2D_RenderThread;
+
+char _O2D_shaderCacheDirectory[256];
+
+// Set on the thread that holds a render thread's upload context
+O2D_THREAD_LOCAL bool _O2D_threadHasUploadContext;
+
+// Whether every texture created so far has full alpha everywhere, indexed by texture name
+bool *_O2D_opaqueTextures;
+uint32_t _O2D_opaqueTextureCapacity;
+
+O2D_Allocator _O2D_allocator; // Functions are NULL when the C library's are used
+O2D_THREAD_LOCAL uint64_t _O2D_threadAllocationNum;
+
+// Set up by O2D_StartCapture(). Global so texture creation, which has no renderer, is recorded too
+O2D_Capture _O2D_capture;
+FILE *_O2D_captureFile; // NULL when no capture is running
+
+// Most fields a call of every kind has, in O2D_CAPTURE_* order
+const uint8_t _O2D_captureWordNums[O2D_CAPTURE_OP_NUM] = {
+    0, 0, 0, 0, 21, 14, O2D_CAPTURE_MAX_WORDS, 4, 2, 4, 1, 1, 4, 1, 1, 16,
+};
 
 void _O2D_WindowResizeCallback(GLFWwindow *window, int32_t width, int32_t height) {
-    glViewport(0, 0, width, height);
+    O2D_Renderer *renderer = glfwGetWindowUserPointer(window);
+    renderer->framebufferWidth = width;
+    renderer->framebufferHeight = height;
+    // The render thread picks the new size up with the next frame
+    if (renderer->renderThread == NULL)
+        glViewport(0, 0, width, height);
 }
+void O2D_SetShaderCacheDirectory(const char *directory) {
+    snprintf(_O2D_shaderCacheDirectory, sizeof(_O2D_shaderCacheDirectory), "%s", directory ? directory : "");
+}
+
 bool O2D_Create(O2D_Renderer* renderer, const char* title, uint32_t width, uint32_t height) {
     O2D_ZeroMem(renderer, sizeof(O2D_Renderer));
     renderer->width = width;
@@ -36,6 +133,11 @@ bool O2D_Create(O2D_Renderer* renderer, const char* title, uint32_t width, uint3
     renderer->window = glfwCreateWindow(width, height, title, 0, 0);
     glfwSetWindowAspectRatio(renderer->window, renderer->width, renderer->height);
     glfwSetFramebufferSizeCallback(renderer->window, _O2D_WindowResizeCallback);
+    glfwSetWindowUserPointer(renderer->window, renderer);
+    int32_t framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(renderer->window, &framebufferWidth, &framebufferHeight);
+    renderer->framebufferWidth = framebufferWidth;
+    renderer->framebufferHeight = framebufferHeight;
 
     glfwMakeContextCurrent(renderer->window);
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
@@ -43,141 +145,549 @@ bool O2D_Create(O2D_Renderer* renderer, const char* title, uint32_t width, uint3
         return false;
     }
     glEnable(GL_TEXTURE_2D);
-    glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    renderer->vtxBuf.vertices = malloc(O2D_MIN_VTX_NUM * sizeof(O2D_Vertex));
-    renderer->vtxBuf.capacity = O2D_MIN_VTX_NUM;
+    glDepthFunc(GL_LEQUAL); // Depth stops growing after O2D_MAX_DEPTH_STEPS primitives
+    O2D_ResetStateCache(renderer);
+    renderer->swapInterval = -1; // Driver default until O2D_SetSwapInterval() is called
+    // Vsync, which most drivers start with, where the platform can't tell
+    renderer->defaultSwapInterval = _O2D_QuerySwapInterval();
+    if (renderer->defaultSwapInterval < 0)
+        renderer->defaultSwapInterval = 1;
+    renderer->frameArena.memory = _O2D_Malloc(O2D_FRAME_ARENA_SIZE);
+    renderer->frameArena.capacity = O2D_FRAME_ARENA_SIZE;
+    renderer->frameLimiter.spinTime = 2000000;
+    O2D_SetBufferPolicy(renderer, 1.5f, O2D_DEFAULT_BUFFER_DECAY_FRAMES, O2D_DEFAULT_MAX_BUFFER_VERTICES);
 
     glGenVertexArrays(1, &renderer->VAO);
     glGenBuffers(1, &renderer->VBO);
-    glBindVertexArray(renderer->VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, renderer->VBO);
+    _O2D_BindVertexArray(renderer, renderer->VAO);
+    _O2D_BindArrayBuffer(renderer, renderer->VBO);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(O2D_Vertex), (void*)offsetof(O2D_Vertex, x));
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(O2D_Vertex), (void*)offsetof(O2D_Vertex, u));
     glEnableVertexAttribArray(2);
     glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(O2D_Vertex), (void*)offsetof(O2D_Vertex, textureSlot));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(O2D_Vertex), (void*)offsetof(O2D_Vertex, z));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(O2D_Vertex), (void*)offsetof(O2D_Vertex, color));
+    glGenVertexArrays(1, &renderer->spriteVAO);
+    glCreateBuffers(1, &renderer->spriteSSBO);
 
-    _O2D_CreateShaders(renderer);
-    glUseProgram(renderer->shader);
-    renderer->projectionMatrixUniformLocation =
-        glGetUniformLocation(renderer->shader, "uViewProj");
-    _O2D_UpdateViewProjMatrix(renderer);
-    // Fill the texture slots
-    uint32_t location = glGetUniformLocation(renderer->shader, "uTextures");
-    const int samplers[32] = {
-        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
-        17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31
-    };
-    glUniform1iv(location, O2D_MAX_TEX_SLOTS, &samplers[0]);
+    O2D_TextureSlotBuffer *textureSlots = &renderer->streams[O2D_PASS_ORDERED].textureSlots;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &textureSlots->capacity);
+    textureSlots->slotNum = textureSlots->capacity < O2D_MAX_TEX_SLOTS ? textureSlots->capacity : O2D_MAX_TEX_SLOTS;
+    renderer->streams[O2D_PASS_OPAQUE].textureSlots = *textureSlots;
+    renderer->state = (O2D_RenderState){ .tint = { 1.0f, 1.0f, 1.0f, 1.0f }, .alphaThreshold = 0.0f, .blending = true };
 
-    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &renderer->textureSlots.capacity);
+    _O2D_InitProgramCache(renderer);
+    _O2D_InitIndirectSubmit(renderer);
+    _O2D_UpdateStreaming(renderer);
+    _O2D_CreateShaders(renderer);
+    _O2D_ComputeViewProjMatrix(renderer);
+    _O2D_ApplyRenderState(renderer, &renderer->state, renderer->viewProjMatrix);
 
     return true;
 }
 
 void O2D_Terminate(O2D_Renderer* renderer) {
-    free(renderer->vtxBuf.vertices);
+    O2D_StopRenderThread(renderer);
+    _O2D_ReleaseGpuTimers(renderer);
+    _O2D_ReleaseOverdrawProfiler(renderer);
+    _O2D_ReleaseProgramCache(renderer);
+    _O2D_ReleaseIndirectSubmit(renderer);
+    _O2D_ReleaseStreamRing(renderer);
+    _O2D_ReleaseDirtyRects(renderer);
+    _O2D_ReleaseFrameArena(&renderer->frameArena);
+    O2D_DisableFlightRecorder(renderer);
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        _O2D_Free(renderer->streams[i].vtxBuf.vertices);
+        _O2D_Free(renderer->streams[i].spriteBuf.sprites);
+        _O2D_Free(renderer->streams[i].batches);
+    }
 }
 
 void O2D_Begin(O2D_Renderer* renderer) {
+    O2D_ZONE_BEGIN("O2D_Begin");
+    if (_O2D_captureFile != NULL)
+        _O2D_CaptureCall(O2D_CAPTURE_BEGIN, NULL, 0);
+    renderer->frameBeginTime = _O2D_GetTimeNs();
+    O2D_ZeroMem(&renderer->stats, sizeof(O2D_FrameStats));
+    renderer->stats.frameIndex = renderer->frameIndex;
+    renderer->stats.beginTime = renderer->frameBeginTime;
+    _O2D_ResetFrameArena(&renderer->frameArena);
+    renderer->frameAllocationBase = _O2D_threadAllocationNum;
     O2D_ClearBatch(renderer);
-    glClear(GL_COLOR_BUFFER_BIT);
+    renderer->depthCounter = 0;
+    // With a render thread the clear happens when the frame gets submitted
+    if (renderer->renderThread == NULL) {
+        _O2D_BeginGpuFrame(renderer, renderer->frameIndex, renderer->gpuTiming);
+        _O2D_BeginOverdrawFrame(renderer, renderer->framebufferWidth, renderer->framebufferHeight,
+                                renderer->overdrawProfiling);
+        // Dirty rectangles clear once they know where
+        if (renderer->dirtyRects) {
+            renderer->dirty.pending = true;
+        }
+        else {
+            if (renderer->dirty.framebuffer != 0)
+                _O2D_ReleaseDirtyRects(renderer);
+            _O2D_ClearFrame(renderer, renderer->depthSorting);
+        }
+    }
+    O2D_ZONE_END("O2D_Begin");
 }
 
 void O2D_End(O2D_Renderer* renderer) {
-    O2D_RenderBatch(renderer);
-    glfwSwapBuffers(renderer->window);
-    glfwPollEvents();
+    O2D_ZONE_BEGIN("O2D_End");
+    uint64_t submitTime;
+    if (renderer->renderThread != NULL) {
+        submitTime = _O2D_GetTimeNs();
+        _O2D_QueueFrame(renderer);
+    }
+    else {
+        if (renderer->dirtyRects)
+            _O2D_EndDirtyFrame(renderer);
+        else
+            O2D_RenderBatch(renderer);
+        _O2D_EndGpuFrame(renderer);
+        _O2D_EndOverdrawFrame(renderer, renderer->frameIndex);
+        _O2D_CopyGpuResults(renderer, &renderer->stats);
+        renderer->overdrawReport = renderer->overdraw.result;
+        submitTime = _O2D_GetTimeNs();
+        _O2D_PaceFrame(&renderer->frameLimiter);
+        O2D_ZONE_BEGIN("glfwSwapBuffers");
+        glfwSwapBuffers(renderer->window);
+        O2D_ZONE_END("glfwSwapBuffers");
+    }
+    if (!renderer->onDemand) {
+        O2D_ZONE_BEGIN("glfwPollEvents");
+        glfwPollEvents();
+        O2D_ZONE_END("glfwPollEvents");
+    }
+
+    uint64_t endTime = _O2D_GetTimeNs();
+    O2D_FrameStats *stats = &renderer->stats;
+    stats->cpuTime = (submitTime - renderer->frameBeginTime) / 1e6;
+    if (renderer->frameEndTime != 0)
+        stats->frameTime = (endTime - renderer->frameEndTime) / 1e6;
+    renderer->frameEndTime = endTime;
+    stats->allocationNum += (uint32_t)(_O2D_threadAllocationNum - renderer->frameAllocationBase);
+    if (renderer->allocationCheck && stats->allocationNum > 0) {
+        printf("Frame %llu made %u heap allocations.\n", (unsigned long long)stats->frameIndex, stats->allocationNum);
+        assert(stats->allocationNum == 0);
+    }
+    renderer->lastStats = *stats;
+    _O2D_RecordFlightFrame(renderer);
+    renderer->frameIndex++;
+    // After the flush O2D_End() does itself, which replays as an O2D_RenderBatch() call
+    if (_O2D_captureFile != NULL)
+        _O2D_CaptureCall(O2D_CAPTURE_END, NULL, 0);
+    O2D_ZONE_END("O2D_End");
 }
 
-void O2D_RenderBatch(O2D_Renderer* renderer) {
-    glUseProgram(renderer->shader);
-    _O2D_UpdateViewProjMatrix(renderer);
-    // Only reallocate data if the number of vertices exceeds the vertex buffer capacity
-    if (renderer->vtxBuf.number > renderer->vtxBuf.maxNumber) {
-        renderer->vtxBuf.maxNumber = renderer->vtxBuf.number;
-        glBufferData(GL_ARRAY_BUFFER, renderer->vtxBuf.number * sizeof(O2D_Vertex),
-                     renderer->vtxBuf.vertices, GL_DYNAMIC_DRAW);
+void _O2D_EndDirtyFrame(O2D_Renderer* renderer) {
+    _O2D_FinishStreams(renderer);
+    if (renderer->dirty.pending) {
+        _O2D_ComputeViewProjMatrix(renderer);
+        renderer->stats.elidedBytes +=
+            _O2D_SubmitDirtyFrame(renderer, renderer->streams, renderer->viewProjMatrix, renderer->clearColor,
+                                  renderer->submitMode, &renderer->bufferPolicy, renderer->depthSorting,
+                                  renderer->framebufferWidth, renderer->framebufferHeight);
+        for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+            renderer->stats.uploadedBytes += renderer->streams[i].vtxBuf.number * sizeof(O2D_Vertex) +
+                                             renderer->streams[i].spriteBuf.number * sizeof(O2D_SpriteRecord);
+            _O2D_TrimStream(renderer, &renderer->streams[i]);
+            _O2D_ResetStream(&renderer->streams[i]);
+        }
     }
     else {
-        glBufferSubData(
-            GL_ARRAY_BUFFER, 0, renderer->vtxBuf.number * sizeof(O2D_Vertex),
-            renderer->vtxBuf.vertices
-        );
+        // The rest of a frame that was submitted in parts
+        O2D_RenderBatch(renderer);
+        _O2D_BlitDirtyFramebuffer(renderer);
+    }
+    renderer->stats.redrawnPixels += renderer->dirty.redrawnPixels;
+}
+
+void O2D_RenderBatch(O2D_Renderer* renderer) {
+    if (_O2D_captureFile != NULL)
+        _O2D_CaptureCall(O2D_CAPTURE_RENDER_BATCH, NULL, 0);
+    // The render thread draws everything at the end of the frame
+    if (renderer->renderThread != NULL) {
+        _O2D_CloseBatch(renderer);
+        return;
+    }
+    _O2D_FinishStreams(renderer);
+    if (_O2D_StreamsEmpty(renderer->streams))
+        return;
+    // One upload for every batch closed so far, then the draws
+    _O2D_ComputeViewProjMatrix(renderer);
+    // A frame drawn in parts can't be compared with the previous one
+    if (renderer->dirtyRects && renderer->dirty.pending) {
+        _O2D_BindDirtyFramebuffer(renderer, renderer->framebufferWidth, renderer->framebufferHeight);
+        _O2D_ClearFrame(renderer, renderer->depthSorting);
+        renderer->dirty.pending = false;
+        renderer->dirty.valid = false;
+        renderer->dirty.redrawnPixels = (uint64_t)renderer->framebufferWidth * renderer->framebufferHeight;
+    }
+    // The rest of a streamed frame is one more chunk. Opaque batches from depth sorting
+    // turned on halfway need the whole frame
+    if (renderer->sealVertexNum != UINT32_MAX && renderer->streams[O2D_PASS_OPAQUE].batchNum == 0) {
+        _O2D_SealChunk(renderer);
+        return;
+    }
+    renderer->stats.elidedBytes += _O2D_SubmitBatches(renderer, renderer->streams, renderer->viewProjMatrix,
+                                                      renderer->submitMode, &renderer->bufferPolicy);
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        renderer->stats.uploadedBytes += renderer->streams[i].vtxBuf.number * sizeof(O2D_Vertex) +
+                                         renderer->streams[i].spriteBuf.number * sizeof(O2D_SpriteRecord);
+        _O2D_TrimStream(renderer, &renderer->streams[i]);
+        _O2D_ResetStream(&renderer->streams[i]);
     }
-    // Render
-    glBindVertexArray(renderer->VAO);
-    glDrawArrays(GL_TRIANGLES, 0, renderer->vtxBuf.number);
 }
 
 void O2D_ClearBatch(O2D_Renderer *renderer) {
-    renderer->vtxBuf.number = 0;
-    renderer->textureSlots.usedSlots = 0;
-    for (int i = 0; i < O2D_MAX_TEX_SLOTS; i++)
-renderer->textureSlots.slots[i] = O2D_MAX_TEX_SLOTS;
+    if (_O2D_captureFile != NULL)
+        _O2D_CaptureCall(O2D_CAPTURE_CLEAR_BATCH, NULL, 0);
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++)
+        _O2D_ResetStream(&renderer->streams[i]);
 }
 
 bool O2D_WindowIsOpen(O2D_Renderer* renderer) {
     return !glfwWindowShouldClose(renderer->window);
 }
 
-void O2D_PushQuad(O2D_Renderer* renderer, O2D_Quad quad, uint32_t texture) {
-    // Check if texture already exists in the current batch
-    int16_t texSlot = -1;
-    for (int16_t i = 0; i < renderer->textureSlots.capacity; i++) {
-        if (renderer->textureSlots.slots[i] == texture) {
-            texSlot = i;
+void O2D_RunOnDemand(O2D_Renderer* renderer, O2D_DrawFunction draw, void *user, double maxIdle) {
+    // Events are handled right before a frame, so the ones arriving while it is drawn wake the next wait
+    renderer->onDemand = true;
+    bool animating = true; // The first frame doesn't wait
+    while (O2D_WindowIsOpen(renderer)) {
+        O2D_ZONE_BEGIN("O2D_RunOnDemand wait");
+        if (animating)
+            glfwPollEvents();
+        else if (maxIdle > 0)
+            glfwWaitEventsTimeout(maxIdle);
+        else
+            glfwWaitEvents();
+        O2D_ZONE_END("O2D_RunOnDemand wait");
+        if (!O2D_WindowIsOpen(renderer))
             break;
+        O2D_Begin(renderer);
+        animating = draw(renderer, user);
+        O2D_End(renderer);
+    }
+    renderer->onDemand = false;
+}
+
+void O2D_Invalidate(O2D_Renderer* renderer) {
+    (void)renderer;
+    glfwPostEmptyEvent();
+}
+
+void _O2D_PushQuadSlow(O2D_Renderer* renderer, const O2D_Quad quad, uint32_t texture) {
+    O2D_ZONE_BEGIN("O2D_PushQuad");
+    if (_O2D_captureFile != NULL) {
+        _O2D_CaptureTextureUse(texture);
+        uint32_t words[21] = { texture };
+        _O2D_CaptureVertices(words + 1, quad, 4);
+        _O2D_CaptureCall(O2D_CAPTURE_QUAD, words, 21);
+    }
+    O2D_BatchStream *stream = _O2D_SelectStream(renderer, texture, _O2D_VertexAlpha(quad, 4));
+    _O2D_MakeChunkRoom(renderer, stream, 6, 0);
+    _O2D_SetBatchFormat(renderer, stream, O2D_VERTEX_FORMAT_BATCH);
+    int16_t texSlot = _O2D_GetTextureSlot(renderer, stream, texture);
+    O2D_VertexBuffer *vtxBuf = &stream->vtxBuf;
+    _O2D_EnsureVtxBufSize(&renderer->bufferPolicy, vtxBuf, vtxBuf->number + 6);
+    _O2D_WriteQuadVertices(vtxBuf->vertices + vtxBuf->number, quad, texSlot, _O2D_NextDepth(renderer));
+    vtxBuf->number += 6;
+    O2D_ZONE_END("O2D_PushQuad");
+}
+
+void O2D_PushQuadTinted(O2D_Renderer* renderer, const O2D_Quad quad, uint32_t texture, uint32_t tint) {
+    O2D_Quad tinted;
+    memcpy(tinted, quad, sizeof(O2D_Quad));
+    for (uint8_t i = 0; i < 4; i++)
+        tinted[i].color = _O2D_MultiplyColor(quad[i].color, tint);
+    O2D_PushQuad(renderer, tinted, texture);
+}
+
+void O2D_PushColoredQuad(O2D_Renderer* renderer, const O2D_Quad quad, uint32_t color) {
+    O2D_Quad colored;
+    memcpy(colored, quad, sizeof(O2D_Quad));
+    for (uint8_t i = 0; i < 4; i++)
+        colored[i].color = color;
+    O2D_PushQuad(renderer, colored, O2D_NO_TEXTURE);
+}
+
+void O2D_PushTriangle(O2D_Renderer* renderer, const O2D_Vertex triangle[3], uint32_t texture) {
+    O2D_ZONE_BEGIN("O2D_PushTriangle");
+    if (_O2D_captureFile != NULL) {
+        _O2D_CaptureTextureUse(texture);
+        uint32_t words[16] = { texture };
+        _O2D_CaptureVertices(words + 1, triangle, 3);
+        _O2D_CaptureCall(O2D_CAPTURE_TRIANGLE, words, 16);
+    }
+    O2D_BatchStream *stream = _O2D_SelectStream(renderer, texture, _O2D_VertexAlpha(triangle, 3));
+    _O2D_MakeChunkRoom(renderer, stream, 3, 0);
+    _O2D_SetBatchFormat(renderer, stream, O2D_VERTEX_FORMAT_BATCH);
+    int16_t texSlot = _O2D_GetTextureSlot(renderer, stream, texture);
+    float z = _O2D_NextDepth(renderer);
+    O2D_VertexBuffer *vtxBuf = &stream->vtxBuf;
+    _O2D_EnsureVtxBufSize(&renderer->bufferPolicy, vtxBuf, vtxBuf->number + 3);
+    for (uint8_t i = 0; i < 3; i++) {
+        O2D_Vertex *vertex = &vtxBuf->vertices[vtxBuf->number++];
+        *vertex = triangle[i];
+        vertex->textureSlot = texSlot;
+        vertex->z = z;
+    }
+    O2D_ZONE_END("O2D_PushTriangle");
+}
+
+void O2D_PushQuads(O2D_Renderer* renderer, const O2D_Vertex *vertices, uint32_t quadNum, uint32_t texture) {
+    // A capture records quads one by one
+    if (_O2D_captureFile != NULL || quadNum == 0) {
+        for (uint32_t i = 0; i < quadNum; i++)
+            O2D_PushQuad(renderer, vertices + i * 4, texture);
+        return;
+    }
+    O2D_ZONE_BEGIN("O2D_PushQuads");
+    // All of them go to one pass, translucent vertex colors keep them out of the opaque one
+    float alpha = 1.0f;
+    for (uint32_t i = 0; renderer->depthSorting && i < quadNum && alpha >= 1.0f; i++)
+        alpha = _O2D_VertexAlpha(vertices + i * 4, 4);
+    O2D_BatchStream *stream = _O2D_SelectStream(renderer, texture, alpha);
+    O2D_VertexBuffer *vtxBuf = &stream->vtxBuf;
+    // In one go unless streaming seals chunks in between
+    while (quadNum > 0) {
+        _O2D_MakeChunkRoom(renderer, stream, 6, 0);
+        _O2D_SetBatchFormat(renderer, stream, O2D_VERTEX_FORMAT_BATCH);
+        int16_t texSlot = _O2D_GetTextureSlot(renderer, stream, texture);
+        uint32_t room = (renderer->sealVertexNum - vtxBuf->number) / 6;
+        uint32_t pushNum = quadNum < room ? quadNum : room;
+        _O2D_EnsureVtxBufSize(&renderer->bufferPolicy, vtxBuf, vtxBuf->number + pushNum * 6);
+        O2D_Vertex *dst = vtxBuf->vertices + vtxBuf->number;
+        for (uint32_t i = 0; i < pushNum; i++)
+            _O2D_WriteQuadVertices(dst + i * 6, vertices + i * 4, texSlot, _O2D_NextDepth(renderer));
+        vtxBuf->number += pushNum * 6;
+        vertices += pushNum * 4;
+        quadNum -= pushNum;
+    }
+    O2D_ZONE_END("O2D_PushQuads");
+}
+
+void O2D_PushQuadsMixed(O2D_Renderer* renderer, const O2D_Vertex *vertices, const uint32_t *textures, uint32_t quadNum) {
+    if (_O2D_captureFile != NULL) {
+        for (uint32_t i = 0; i < quadNum; i++)
+            O2D_PushQuad(renderer, vertices + i * 4, textures[i]);
+        return;
+    }
+    O2D_ZONE_BEGIN("O2D_PushQuadsMixed");
+    O2D_BatchStream *stream = NULL;
+    int16_t texSlot = 0;
+    for (uint32_t i = 0; i < quadNum; i++) {
+        if (i == 0 || textures[i] != textures[i - 1] || stream->vtxBuf.number + 6 > renderer->sealVertexNum ||
+            (renderer->depthSorting && _O2D_SelectStream(renderer, textures[i], _O2D_VertexAlpha(vertices + i * 4, 4)) != stream)) {
+            stream = _O2D_SelectStream(renderer, textures[i], _O2D_VertexAlpha(vertices + i * 4, 4));
+            _O2D_MakeChunkRoom(renderer, stream, 6, 0);
+            _O2D_SetBatchFormat(renderer, stream, O2D_VERTEX_FORMAT_BATCH);
+            texSlot = _O2D_GetTextureSlot(renderer, stream, textures[i]);
+            // Enough for the rest, or the rest of the chunk, so it only grows once per pass
+            uint32_t reserve = (quadNum - i) * 6;
+            if (reserve > renderer->sealVertexNum - stream->vtxBuf.number)
+                reserve = renderer->sealVertexNum - stream->vtxBuf.number;
+            _O2D_EnsureVtxBufSize(&renderer->bufferPolicy, &stream->vtxBuf, stream->vtxBuf.number + reserve);
         }
+        O2D_VertexBuffer *vtxBuf = &stream->vtxBuf;
+        _O2D_WriteQuadVertices(vtxBuf->vertices + vtxBuf->number, vertices + i * 4, texSlot, _O2D_NextDepth(renderer));
+        vtxBuf->number += 6;
     }
-    // If the texture doesn't exists, push it to the next available slot
-    if (texSlot == -1) {
-        // If the texture slots are full, render the batch as it is
-        if (renderer->textureSlots.usedSlots >= O2D_MAX_TEX_SLOTS) {
-            O2D_RenderBatch(renderer);
-            O2D_ClearBatch(renderer);
+    O2D_ZONE_END("O2D_PushQuadsMixed");
+}
+
+void O2D_PushSprite(O2D_Renderer* renderer, const O2D_Sprite *sprite, uint32_t texture) {
+    O2D_ZONE_BEGIN("O2D_PushSprite");
+    if (_O2D_captureFile != NULL) {
+        _O2D_CaptureTextureUse(texture);
+        uint32_t words[14] = { texture, _O2D_FloatBits(sprite->x), _O2D_FloatBits(sprite->y),
+                               _O2D_FloatBits(sprite->width), _O2D_FloatBits(sprite->height),
+                               _O2D_FloatBits(sprite->angle) };
+        for (uint8_t i = 0; i < 4; i++) {
+            words[6 + i] = _O2D_FloatBits(sprite->uvRect[i]);
+            words[10 + i] = _O2D_FloatBits(sprite->color[i]);
         }
-        texSlot = renderer->textureSlots.usedSlots++;
-        renderer->textureSlots.slots[texSlot] = texture;
-        glBindTextureUnit(texSlot, texture);
+        _O2D_CaptureCall(O2D_CAPTURE_SPRITE, words, 14);
+    }
+    O2D_BatchStream *stream = _O2D_SelectStream(renderer, texture, sprite->color[3]);
+    _O2D_MakeChunkRoom(renderer, stream, 0, 1);
+    _O2D_SetBatchFormat(renderer, stream, O2D_VERTEX_FORMAT_SPRITE);
+    int16_t texSlot = _O2D_GetTextureSlot(renderer, stream, texture);
+    _O2D_EnsureSpriteBufSize(&renderer->bufferPolicy, &stream->spriteBuf, stream->spriteBuf.number + 1);
+    O2D_SpriteRecord *record = &stream->spriteBuf.sprites[stream->spriteBuf.number++];
+    record->x = sprite->x;
+    record->y = sprite->y;
+    record->width = sprite->width;
+    record->height = sprite->height;
+    record->angle = sprite->angle;
+    uint32_t uv[4];
+    for (uint8_t i = 0; i < 4; i++) {
+        float value = sprite->uvRect[i] < 0.0f ? 0.0f : sprite->uvRect[i] > 1.0f ? 1.0f : sprite->uvRect[i];
+        uv[i] = (uint32_t)(value * 65535.0f + 0.5f);
     }
+    record->uvRect[0] = uv[0] | uv[1] << 16;
+    record->uvRect[1] = uv[2] | uv[3] << 16;
+    record->color = O2D_PackColor(sprite->color[0], sprite->color[1], sprite->color[2], sprite->color[3]);
+    record->textureSlot = texSlot;
+    record->depth = _O2D_NextDepth(renderer);
+    O2D_ZONE_END("O2D_PushSprite");
+}
 
-    for (uint8_t i = 0; i < 4; i++)
-        quad[i].textureSlot = texSlot;
-     _O2D_EnsureVtxBufSize(renderer, renderer->vtxBuf.number + 6);
-    renderer->vtxBuf.vertices[renderer->vtxBuf.number++] = quad[0];
-    renderer->vtxBuf.vertices[renderer->vtxBuf.number++] = quad[1];
-    renderer->vtxBuf.vertices[renderer->vtxBuf.number++] = quad[2];
-    renderer->vtxBuf.vertices[renderer->vtxBuf.number++] = quad[0];
-    renderer->vtxBuf.vertices[renderer->vtxBuf.number++] = quad[2];
-    renderer->vtxBuf.vertices[renderer->vtxBuf.number++] = quad[3];
+bool O2D_BuildSpriteMesh(O2D_SpriteMesh *mesh, const uint8_t *imageData, int32_t width, int32_t height,
+                         const int32_t region[4], uint8_t alphaThreshold, uint8_t maxPoints) {
+    int32_t regionX = region ? region[0] : 0, regionY = region ? region[1] : 0;
+    int32_t regionWidth = region ? region[2] : width, regionHeight = region ? region[3] : height;
+    mesh->pointNum = 0;
+    if (regionWidth <= 0 || regionHeight <= 0 || regionX < 0 || regionY < 0 ||
+        regionWidth > width - regionX || regionHeight > height - regionY) {
+        printf("Sprite mesh region %d, %d, %d, %d is empty or outside the %dx%d image.\n",
+               regionX, regionY, regionWidth, regionHeight, width, height);
+        return false;
+    }
+    if (maxPoints < 3)
+        maxPoints = 3;
+    if (maxPoints > O2D_MAX_MESH_POINTS)
+        maxPoints = O2D_MAX_MESH_POINTS;
+    // The ends of the visible span of every row. Linear filtering blends visible texels half a
+    // texel past their edges, so the pixel corners are pushed out by that much
+    const float bounds[4] = { regionX, regionY, regionX + regionWidth, regionY + regionHeight };
+    float (*points)[2] = _O2D_Malloc((size_t)regionHeight * 4 * sizeof(float[2]));
+    if (points == NULL) {
+        printf("Could not allocate the sprite mesh outline.\n");
+        return false;
+    }
+    uint32_t pointNum = 0;
+    for (int32_t y = regionY; y < regionY + regionHeight; y++) {
+        const uint8_t *row = imageData + ((size_t)y * width) * 4;
+        int32_t left = regionX, right = regionX + regionWidth - 1;
+        while (left <= right && row[left * 4 + 3] <= alphaThreshold)
+            left++;
+        while (right >= left && row[right * 4 + 3] <= alphaThreshold)
+            right--;
+        if (left > right)
+            continue;
+        float spanX[2] = { left - 0.5f, right + 1.5f };
+        float spanY[2] = { y - 0.5f, y + 1.5f };
+        for (uint8_t i = 0; i < 4; i++) {
+            points[pointNum][0] = fminf(fmaxf(spanX[i & 1], bounds[0]), bounds[2]);
+            points[pointNum][1] = fminf(fmaxf(spanY[i >> 1], bounds[1]), bounds[3]);
+            pointNum++;
+        }
+    }
+    if (pointNum == 0) {
+        _O2D_Free(points);
+        return false;
+    }
+    pointNum = _O2D_ConvexHull(points, pointNum);
+    pointNum = _O2D_SimplifyHull(points, pointNum, maxPoints, bounds);
+    if (pointNum > maxPoints) {
+        // Nothing fits inside the region anymore, the region itself always does
+        float corners[4][2] = { { bounds[0], bounds[1] }, { bounds[2], bounds[1] },
+                                { bounds[2], bounds[3] }, { bounds[0], bounds[3] } };
+        memcpy(points, corners, sizeof(corners));
+        pointNum = 4;
+    }
+    for (uint32_t i = 0; i < pointNum; i++) {
+        mesh->points[i][0] = (points[i][0] - regionX) / regionWidth;
+        mesh->points[i][1] = (points[i][1] - regionY) / regionHeight;
+    }
+    mesh->pointNum = pointNum;
+    _O2D_Free(points);
+    return true;
 }
 
-void O2D_MakeRect(O2D_Quad quad, float x, float y, float width, float height, float angle) {
-    quad[0] = (O2D_Vertex){ x - width / 2.0f, y - height / 2.0f, 0.0f, 1.0f };
-    quad[1] = (O2D_Vertex){ x - width / 2.0f, y + height / 2.0f, 0.0f, 0.0f };
-    quad[2] = (O2D_Vertex){ x + width / 2.0f, y + height / 2.0f, 1.0f, 0.0f };
-    quad[3] = (O2D_Vertex){ x + width / 2.0f, y - height / 2.0f, 1.0f, 1.0f };
-    if (angle != 0.0f) {
-        for (uint8_t i = 0; i < 4; i++)
-            _O2D_RotatePoint(&quad[i].x, &quad[i].y, x, y, angle);
+void O2D_PushSpriteMesh(O2D_Renderer* renderer, const O2D_SpriteMesh *mesh, const O2D_Quad quad, uint32_t texture) {
+    if (mesh->pointNum < 3)
+        return;
+    O2D_ZONE_BEGIN("O2D_PushSpriteMesh");
+    if (_O2D_captureFile != NULL) {
+        _O2D_CaptureTextureUse(texture);
+        uint32_t words[O2D_CAPTURE_MAX_WORDS] = { mesh->pointNum, texture };
+        _O2D_CaptureVertices(words + 2, quad, 4);
+        for (uint8_t i = 0; i < mesh->pointNum; i++) {
+            words[22 + i * 2] = _O2D_FloatBits(mesh->points[i][0]);
+            words[23 + i * 2] = _O2D_FloatBits(mesh->points[i][1]);
+        }
+        _O2D_CaptureCall(O2D_CAPTURE_SPRITE_MESH, words, 22 + mesh->pointNum * 2);
+    }
+    O2D_BatchStream *stream = _O2D_SelectStream(renderer, texture, _O2D_VertexAlpha(quad, 4));
+    _O2D_MakeChunkRoom(renderer, stream, (mesh->pointNum - 2) * 3, 0);
+    _O2D_SetBatchFormat(renderer, stream, O2D_VERTEX_FORMAT_BATCH);
+    int16_t texSlot = _O2D_GetTextureSlot(renderer, stream, texture);
+    float z = _O2D_NextDepth(renderer);
+    // quad[1] sits at (s, t) = (0, 0), quad[2] at (1, 0), quad[3] at (1, 1) and quad[0] at (0, 1)
+    O2D_Vertex vertices[O2D_MAX_MESH_POINTS];
+    for (uint8_t i = 0; i < mesh->pointNum; i++) {
+        float s = mesh->points[i][0], t = mesh->points[i][1];
+        float weights[4] = { (1.0f - s) * t, (1.0f - s) * (1.0f - t), s * (1.0f - t), s * t };
+        O2D_Vertex *vertex = &vertices[i];
+        O2D_ZeroMem(vertex, sizeof(O2D_Vertex));
+        float color[4] = { 0 };
+        for (uint8_t j = 0; j < 4; j++) {
+            vertex->x += quad[j].x * weights[j];
+            vertex->y += quad[j].y * weights[j];
+            vertex->u += quad[j].u * weights[j];
+            vertex->v += quad[j].v * weights[j];
+            for (uint8_t k = 0; k < 4; k++)
+                color[k] += (float)(quad[j].color >> (k * 8) & 0xFF) / 255.0f * weights[j];
+        }
+        vertex->color = O2D_PackColor(color[0], color[1], color[2], color[3]);
+        vertex->textureSlot = texSlot;
+        vertex->z = z;
     }
+    O2D_VertexBuffer *vtxBuf = &stream->vtxBuf;
+    _O2D_EnsureVtxBufSize(&renderer->bufferPolicy, vtxBuf, vtxBuf->number + (mesh->pointNum - 2) * 3);
+    for (uint8_t i = 1; i + 1 < mesh->pointNum; i++) {
+        vtxBuf->vertices[vtxBuf->number++] = vertices[0];
+        vtxBuf->vertices[vtxBuf->number++] = vertices[i];
+        vtxBuf->vertices[vtxBuf->number++] = vertices[i + 1];
+    }
+    O2D_ZONE_END("O2D_PushSpriteMesh");
 }
 
 uint32_t O2D_CreateTexture(uint8_t *textureData, int32_t width, int32_t height) {
+    // Direct state access, so the texture units the state cache tracks aren't disturbed
     uint32_t texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, textureData);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    int32_t levels = 1;
+    while ((width | height) >> levels)
+        levels++;
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureStorage2D(texture, levels, GL_RGBA8, width, height);
+    if (textureData != NULL) {
+        glTextureSubImage2D(texture, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, textureData);
+        glGenerateTextureMipmap(texture);
+    }
+    // Classify the texture for depth sorting. Textures without data are assumed transparent
+    if (texture >= _O2D_opaqueTextureCapacity) {
+        uint32_t capacity = _O2D_opaqueTextureCapacity ? _O2D_opaqueTextureCapacity : 64;
+        while (capacity <= texture)
+            capacity *= 2;
+        _O2D_opaqueTextures = _O2D_Realloc(_O2D_opaqueTextures, capacity * sizeof(bool));
+        O2D_ZeroMem(_O2D_opaqueTextures + _O2D_opaqueTextureCapacity,
+                    (capacity - _O2D_opaqueTextureCapacity) * sizeof(bool));
+        _O2D_opaqueTextureCapacity = capacity;
+    }
+    bool opaque = textureData != NULL;
+    for (int32_t i = 0; opaque && i < width * height; i++)
+        opaque = textureData[i * 4 + 3] == 255;
+    _O2D_opaqueTextures[texture] = opaque;
+    if (_O2D_captureFile != NULL)
+        _O2D_CaptureTexture(texture, textureData, width, height);
+    // The render thread can only use the texture once the upload context is done with it
+    if (_O2D_threadHasUploadContext)
+        glFinish();
     return texture;
 }
 
@@ -208,99 +718,2850 @@ void O2D_ResetAnimation(O2D_Animation *animation) {
     animation->timer = 0;
 }
 
-void _O2D_EnsureVtxBufSize(O2D_Renderer *renderer, uint32_t requiredCapacity) {
-    if (renderer->vtxBuf.capacity < requiredCapacity) {
-        renderer->vtxBuf.capacity = requiredCapacity * 2;
-        renderer->vtxBuf.vertices =
-            realloc(renderer->vtxBuf.vertices, renderer->vtxBuf.capacity * sizeof(O2D_Vertex));
+void O2D_EnableGpuTimers(O2D_Renderer *renderer, bool enable) {
+    renderer->gpuTiming = enable;
+}
+
+const O2D_FrameStats *O2D_GetFrameStats(O2D_Renderer *renderer) {
+    return &renderer->lastStats;
+}
+
+void O2D_EnableOverdrawProfiling(O2D_Renderer *renderer, bool enable) {
+    renderer->overdrawProfiling = enable;
+}
+
+const O2D_OverdrawReport *O2D_GetOverdrawReport(O2D_Renderer *renderer) {
+    return &renderer->overdrawReport;
+}
+
+void O2D_EnableFlightRecorder(O2D_Renderer *renderer, double threshold, const char *pathPrefix) {
+    O2D_FlightRecorder *recorder = &renderer->flightRecorder;
+    if (recorder->frames == NULL)
+        recorder->frames = _O2D_Malloc(O2D_FLIGHT_RECORDER_FRAMES * sizeof(O2D_FrameStats));
+    recorder->head = 0;
+    recorder->frameNum = 0;
+    recorder->threshold = threshold;
+    snprintf(recorder->pathPrefix, sizeof(recorder->pathPrefix), "%s", pathPrefix);
+}
+
+void O2D_DisableFlightRecorder(O2D_Renderer *renderer) {
+    _O2D_Free(renderer->flightRecorder.frames);
+    renderer->flightRecorder.frames = NULL;
+}
+
+bool O2D_StartCapture(O2D_Renderer *renderer, const char *path) {
+    O2D_StopCapture();
+    O2D_Capture *capture = &_O2D_capture;
+    _O2D_captureFile = fopen(path, "wb");
+    if (_O2D_captureFile == NULL) {
+        printf("Could not open capture file %s.\n", path);
+        return false;
     }
+    const uint8_t header[8] = { 'O', '2', 'D', 'C', O2D_CAPTURE_VERSION };
+    capture->failed = fwrite(header, sizeof(header), 1, _O2D_captureFile) != 1;
+    // The replay starts from the render state the capture started with
+    uint32_t words[4];
+    for (uint8_t i = 0; i < 4; i++)
+        words[i] = _O2D_FloatBits(renderer->clearColor[i]);
+    _O2D_CaptureCall(O2D_CAPTURE_CLEAR_COLOR, words, 4);
+    for (uint8_t i = 0; i < 4; i++)
+        words[i] = _O2D_FloatBits(renderer->state.tint[i]);
+    _O2D_CaptureCall(O2D_CAPTURE_TINT, words, 4);
+    words[0] = _O2D_FloatBits(renderer->state.alphaThreshold);
+    _O2D_CaptureCall(O2D_CAPTURE_ALPHA_TEST, words, 1);
+    words[0] = renderer->state.blending;
+    _O2D_CaptureCall(O2D_CAPTURE_BLENDING, words, 1);
+    words[0] = renderer->depthSorting;
+    _O2D_CaptureCall(O2D_CAPTURE_DEPTH_SORTING, words, 1);
+    words[0] = renderer->submitMode;
+    _O2D_CaptureCall(O2D_CAPTURE_SUBMIT_MODE, words, 1);
+    words[0] = _O2D_FloatBits(renderer->cameraX);
+    words[1] = _O2D_FloatBits(renderer->cameraY);
+    _O2D_CaptureCall(O2D_CAPTURE_CAMERA, words, 2);
+    return true;
 }
 
-void _O2D_CreateShaders(O2D_Renderer* renderer) {
-    int success;
-    char errorLog[512];
+bool O2D_StopCapture(void) {
+    O2D_Capture *capture = &_O2D_capture;
+    if (_O2D_captureFile == NULL)
+        return true;
+    _O2D_FlushCapture();
+    bool written = fclose(_O2D_captureFile) == 0 && !capture->failed;
+    if (!written)
+        printf("Could not write the capture.\n");
+    _O2D_ReleaseCaptureHistory(&capture->history);
+    _O2D_Free(capture->textures);
+    O2D_ZeroMem(capture, sizeof(O2D_Capture));
+    return written;
+}
 
-    // Vertex shader
-    uint32_t vertexShader;
-    vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &_O2D_vertexShader, NULL);
-    glCompileShader(vertexShader);
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-    if(!success) {
-        glGetShaderInfoLog(vertexShader, 512, NULL, errorLog);
-        printf("VERTEX SHADER: COMPILATION_FAILED:\n%s\n", errorLog);
+bool O2D_Replay(O2D_Renderer *renderer, const char *path, uint32_t repeatNum, O2D_ReplayStats *stats) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Could not open capture file %s.\n", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = size > 0 ? _O2D_Malloc(size) : NULL;
+    bool read = data != NULL && fread(data, 1, size, file) == (size_t)size;
+    fclose(file);
+    if (!read || size < 8 || memcmp(data, "O2DC", 4) != 0 || data[4] != O2D_CAPTURE_VERSION) {
+        printf("%s is not a capture this version can replay.\n", path);
+        _O2D_Free(data);
+        return false;
     }
 
-    // Fragment shader
-    uint32_t fragmentShader;
-    fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &_O2D_fragmentShader,  NULL);
-    glCompileShader(fragmentShader);
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if(!success) {
-        glGetShaderInfoLog(fragmentShader, 512, NULL, errorLog);
-        printf("FRAGMENT SHADER: COMPILATION FAILED:\n%s\n", errorLog);
+    // Nothing the replay does ends up in a capture that is running
+    FILE *captureFile = _O2D_captureFile;
+    _O2D_captureFile = NULL;
+    bool visible = glfwGetWindowAttrib(renderer->window, GLFW_VISIBLE);
+    glfwHideWindow(renderer->window);
+    int32_t swapInterval = renderer->swapInterval;
+    uint64_t frameTime = renderer->frameLimiter.targetTime;
+    O2D_SetSwapInterval(renderer, 0);
+    renderer->frameLimiter.targetTime = 0;
+
+    O2D_ReplayStats replayStats;
+    O2D_ZeroMem(&replayStats, sizeof(O2D_ReplayStats));
+    uint32_t *textureMap = NULL, textureMapCapacity = 0;
+    O2D_CaptureReader reader;
+    bool valid = true;
+    uint64_t startTime = _O2D_GetTimeNs();
+    for (uint32_t i = 0; valid && i < repeatNum; i++) {
+        O2D_ZeroMem(&reader, sizeof(O2D_CaptureReader));
+        reader.data = data;
+        reader.size = size;
+        reader.offset = 8;
+        while (valid && reader.offset < reader.size)
+            valid = _O2D_ReplayCall(renderer, &reader, &textureMap, &textureMapCapacity, &replayStats);
+        _O2D_ReleaseCaptureHistory(&reader.history);
     }
-    
-    // Linking to the final shader
-    renderer->shader = glCreateProgram();
-    glAttachShader(renderer->shader, vertexShader);
-    glAttachShader(renderer->shader, fragmentShader);
-    glLinkProgram(renderer->shader);
-    glGetShaderiv(renderer->shader, GL_LINK_STATUS, &success);
-    if(!success) {
-        glGetShaderInfoLog(renderer->shader, 512, NULL, errorLog);
-        printf("SHADER: LINKING FAILED:\n%s\n", errorLog);
+    replayStats.time = (_O2D_GetTimeNs() - startTime) / 1e6;
+    if (!valid)
+        printf("Capture %s is malformed.\n", path);
+
+    _O2D_captureFile = captureFile;
+    renderer->frameLimiter.targetTime = frameTime;
+    renderer->frameLimiter.deadline = 0;
+    // -1 stays the driver default, so the context gets back what the driver started with
+    renderer->swapInterval = swapInterval;
+    if (renderer->renderThread == NULL)
+        glfwSwapInterval(swapInterval >= 0 ? swapInterval : renderer->defaultSwapInterval);
+    if (visible)
+        glfwShowWindow(renderer->window);
+    _O2D_Free(textureMap);
+    _O2D_Free(data);
+    if (stats != NULL)
+        *stats = replayStats;
+    return valid;
+}
+
+void O2D_SetAllocator(const O2D_Allocator *allocator) {
+    if (allocator != NULL)
+        _O2D_allocator = *allocator;
+    else
+        O2D_ZeroMem(&_O2D_allocator, sizeof(O2D_Allocator));
+}
+
+void *O2D_FrameAlloc(O2D_Renderer *renderer, size_t size) {
+    O2D_FrameArena *arena = &renderer->frameArena;
+    size = (size + O2D_FRAME_ARENA_ALIGNMENT - 1) & ~(size_t)(O2D_FRAME_ARENA_ALIGNMENT - 1);
+    arena->requested += size;
+    if (arena->used + size <= arena->capacity) {
+        void *memory = arena->memory + arena->used;
+        arena->used += size;
+        return memory;
+    }
+    // Allocations made so far can't move, the arena grows at the next reset instead
+    if (arena->overflowNum == arena->overflowCapacity) {
+        arena->overflowCapacity = arena->overflowCapacity ? arena->overflowCapacity * 2 : 16;
+        arena->overflow = _O2D_Realloc(arena->overflow, arena->overflowCapacity * sizeof(void*));
     }
+    void *block = _O2D_Malloc(size);
+    arena->overflow[arena->overflowNum++] = block;
+    return block;
 }
 
-void _O2D_UpdateViewProjMatrix(O2D_Renderer* renderer) {
-    float left   = -renderer->width / 2.0f;
-    float right  = renderer->width / 2.0f;
-    float top    = -renderer->height / 2.0f;
-    float bottom = renderer->height / 2.0f;
-    float near   = -1.0f;
-    float far    = 1.0f;
-    renderer->viewProjMatrix[0]  = 2.0f / renderer->width;
-    renderer->viewProjMatrix[1]  = 0;
-    renderer->viewProjMatrix[2]  = 0;
-    renderer->viewProjMatrix[3]  = (right + left) / renderer->width;
-    renderer->viewProjMatrix[4]  = 0;
-    renderer->viewProjMatrix[5]  = -2.0f / renderer->height;
-    renderer->viewProjMatrix[6]  = 0;
-    renderer->viewProjMatrix[7]  = (top + bottom) / renderer->height;
-    renderer->viewProjMatrix[8]  = 0;
-    renderer->viewProjMatrix[9]  = 0;
-    renderer->viewProjMatrix[10] = -2.0f / (far - near);
-    renderer->viewProjMatrix[11] = -(far + near) / (far - near);
-    renderer->viewProjMatrix[12] = 0;
-    renderer->viewProjMatrix[13] = 0;
-    renderer->viewProjMatrix[14] = 0;
-    renderer->viewProjMatrix[15] = 1;
+void O2D_EnableAllocationCheck(O2D_Renderer *renderer, bool enable) {
+    renderer->allocationCheck = enable;
+}
 
-    _O2D_TranslateMatrix(renderer, renderer->viewProjMatrix, renderer->cameraX, renderer->cameraY);
+void O2D_EnableDirtyRects(O2D_Renderer *renderer, bool enable) {
+    renderer->dirtyRects = enable;
+    _O2D_UpdateStreaming(renderer);
+}
 
-    glUniformMatrix4fv(
-        renderer->projectionMatrixUniformLocation,
-        1, GL_FALSE, &renderer->viewProjMatrix[0]
-    );
+void O2D_EnableUploadElision(O2D_Renderer *renderer, bool enable) {
+    renderer->bufferPolicy.elideUploads = enable;
 }
 
-void _O2D_RotatePoint(float *pointX, float *pointY, float pivotX, float pivotY, float angle) {
-  float s = sin(angle);
-  float c = cos(angle);
+void O2D_SetBufferPolicy(O2D_Renderer *renderer, float growth, uint32_t decayFrames, uint32_t maxVertices) {
+    renderer->bufferPolicy.growth = growth < 1.0f ? 1.0f : growth;
+    renderer->bufferPolicy.decayFrames = decayFrames;
+    // Whole sprites and triangles in every chunk
+    maxVertices -= maxVertices % 6;
+    renderer->bufferPolicy.maxVertices = maxVertices > 0 && maxVertices < O2D_MIN_VTX_NUM ? 6 * O2D_MIN_VTX_NUM
+                                                                                           : maxVertices;
+}
 
-  // translate point back to origin:
-  *pointX -= pivotX;
-  *pointY -= pivotY;
+int32_t _O2D_QuerySwapInterval(void) {
+#ifdef _WIN32
+    typedef int (APIENTRY *GetSwapInterval)(void);
+    GetSwapInterval getSwapInterval = (GetSwapInterval)glfwGetProcAddress("wglGetSwapIntervalEXT");
+    if (glfwExtensionSupported("WGL_EXT_swap_control") && getSwapInterval != NULL)
+        return getSwapInterval();
+#else
+    // The prototypes of GL/glx.h without including it. Display is struct _XDisplay, a GLXDrawable an XID
+    typedef struct _XDisplay *(*GetCurrentDisplay)(void);
+    typedef unsigned long (*GetCurrentDrawable)(void);
+    typedef void (*QueryDrawable)(struct _XDisplay *display, unsigned long drawable, int attribute, unsigned int *value);
+    GetCurrentDisplay getCurrentDisplay = (GetCurrentDisplay)glfwGetProcAddress("glXGetCurrentDisplay");
+    GetCurrentDrawable getCurrentDrawable = (GetCurrentDrawable)glfwGetProcAddress("glXGetCurrentDrawable");
+    QueryDrawable queryDrawable = (QueryDrawable)glfwGetProcAddress("glXQueryDrawable");
+    if (glfwExtensionSupported("GLX_EXT_swap_control") && getCurrentDisplay != NULL &&
+        getCurrentDrawable != NULL && queryDrawable != NULL) {
+        unsigned int interval = 0;
+        queryDrawable(getCurrentDisplay(), getCurrentDrawable(), GLX_SWAP_INTERVAL_EXT, &interval);
+        return (int32_t)interval;
+    }
+#endif
+    return -1;
+}
 
-  // rotate point
-  float xnew = *pointX * c - *pointY * s;
-  float ynew = *pointX * s + *pointY * c;
+void O2D_SetSwapInterval(O2D_Renderer *renderer, int32_t interval) {
+    renderer->swapInterval = interval;
+    // The render thread applies it to its own context
+    if (renderer->renderThread == NULL)
+        glfwSwapInterval(interval);
+}
 
-  // translate point back:
-  *pointX = xnew + pivotX;
-  *pointY = ynew + pivotY;
+void O2D_SetTint(O2D_Renderer *renderer, float r, float g, float b, float a) {
+    // Setting the same state again must not split the batch
+    const float *tint = renderer->state.tint;
+    if (tint[0] == r && tint[1] == g && tint[2] == b && tint[3] == a)
+        return;
+    if (_O2D_captureFile != NULL) {
+        uint32_t words[4] = { _O2D_FloatBits(r), _O2D_FloatBits(g), _O2D_FloatBits(b), _O2D_FloatBits(a) };
+        _O2D_CaptureCall(O2D_CAPTURE_TINT, words, 4);
+    }
+    _O2D_CloseBatch(renderer);
+    renderer->state.tint[0] = r;
+    renderer->state.tint[1] = g;
+    renderer->state.tint[2] = b;
+    renderer->state.tint[3] = a;
+}
+
+void O2D_SetAlphaTest(O2D_Renderer *renderer, float threshold) {
+    if (renderer->state.alphaThreshold == threshold)
+        return;
+    if (_O2D_captureFile != NULL) {
+        uint32_t words[1] = { _O2D_FloatBits(threshold) };
+        _O2D_CaptureCall(O2D_CAPTURE_ALPHA_TEST, words, 1);
+    }
+    _O2D_CloseBatch(renderer);
+    renderer->state.alphaThreshold = threshold;
+}
+
+void O2D_SetBlending(O2D_Renderer *renderer, bool enable) {
+    if (renderer->state.blending == enable)
+        return;
+    if (_O2D_captureFile != NULL) {
+        uint32_t words[1] = { enable };
+        _O2D_CaptureCall(O2D_CAPTURE_BLENDING, words, 1);
+    }
+    _O2D_CloseBatch(renderer);
+    renderer->state.blending = enable;
+}
+
+void O2D_SetCamera(O2D_Renderer *renderer, float x, float y) {
+    if (_O2D_captureFile != NULL) {
+        uint32_t words[2] = { _O2D_FloatBits(x), _O2D_FloatBits(y) };
+        _O2D_CaptureCall(O2D_CAPTURE_CAMERA, words, 2);
+    }
+    renderer->cameraX = x;
+    renderer->cameraY = y;
+}
+
+bool O2D_SetSubmitMode(O2D_Renderer *renderer, uint8_t mode) {
+    if (mode == O2D_SUBMIT_MULTI_DRAW_INDIRECT && !renderer->indirect.supported) {
+        printf("Multi-draw indirect submission needs GL_ARB_bindless_texture and GL_ARB_shader_draw_parameters.\n");
+        return false;
+    }
+    // The open chunk goes out before its batches change hands
+    if (renderer->sealVertexNum != UINT32_MAX && mode != O2D_SUBMIT_STREAMING)
+        _O2D_SealChunk(renderer);
+    renderer->submitMode = mode;
+    _O2D_UpdateStreaming(renderer);
+    if (_O2D_captureFile != NULL) {
+        uint32_t words[1] = { mode };
+        _O2D_CaptureCall(O2D_CAPTURE_SUBMIT_MODE, words, 1);
+    }
+    // Start compiling the bindless variant now. The render thread owns the variants otherwise
+    if (mode == O2D_SUBMIT_MULTI_DRAW_INDIRECT && renderer->renderThread == NULL) {
+        O2D_ShaderFeatures features = { renderer->streams[O2D_PASS_ORDERED].textureSlots.slotNum,
+                                        O2D_VERTEX_FORMAT_BATCH, O2D_SHADER_BINDLESS };
+        _O2D_GetShaderVariant(renderer, features, false);
+        features.vertexFormat = O2D_VERTEX_FORMAT_SPRITE;
+        _O2D_GetShaderVariant(renderer, features, false);
+    }
+    return true;
+}
+
+void O2D_SetDepthSorting(O2D_Renderer *renderer, bool enable) {
+    if (_O2D_captureFile != NULL) {
+        uint32_t words[1] = { enable };
+        _O2D_CaptureCall(O2D_CAPTURE_DEPTH_SORTING, words, 1);
+    }
+    _O2D_CloseBatch(renderer);
+    renderer->depthSorting = enable;
+    _O2D_UpdateStreaming(renderer);
+}
+
+void O2D_ResetStateCache(O2D_Renderer *renderer) {
+    if (renderer->renderThread != NULL) {
+        printf("O2D_ResetStateCache() needs the render thread to be stopped.\n");
+        return;
+    }
+    memset(&renderer->stateCache, 0xFF, sizeof(O2D_StateCache));
+    for (uint32_t i = 0; i < renderer->shaderVariantNum; i++)
+        renderer->shaderVariants[i].uniformsValid = false;
+}
+
+void O2D_SetClearColor(O2D_Renderer *renderer, float r, float g, float b, float a) {
+    if (_O2D_captureFile != NULL) {
+        uint32_t words[4] = { _O2D_FloatBits(r), _O2D_FloatBits(g), _O2D_FloatBits(b), _O2D_FloatBits(a) };
+        _O2D_CaptureCall(O2D_CAPTURE_CLEAR_COLOR, words, 4);
+    }
+    renderer->clearColor[0] = r;
+    renderer->clearColor[1] = g;
+    renderer->clearColor[2] = b;
+    renderer->clearColor[3] = a;
+    if (renderer->renderThread == NULL)
+        glClearColor(r, g, b, a);
+}
+
+void *_O2D_RenderThreadMain(void *arg);
+
+bool O2D_StartRenderThread(O2D_Renderer *renderer) {
+    if (renderer->renderThread != NULL)
+        return true;
+    O2D_RenderThread *thread = _O2D_Calloc(1, sizeof(O2D_RenderThread));
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    thread->uploadWindow = glfwCreateWindow(1, 1, "", 0, renderer->window);
+    glfwDefaultWindowHints();
+    if (thread->uploadWindow == NULL) {
+        printf("Could not create the upload context.\n");
+        _O2D_Free(thread);
+        return false;
+    }
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++)
+        thread->streams[i].textureSlots = renderer->streams[i].textureSlots;
+    thread->swapInterval = thread->appliedSwapInterval = renderer->swapInterval;
+    thread->frameLimiter = renderer->frameLimiter;
+    thread->viewportWidth = renderer->framebufferWidth;
+    thread->viewportHeight = renderer->framebufferHeight;
+    pthread_mutex_init(&thread->mutex, NULL);
+    pthread_cond_init(&thread->cond, NULL);
+
+    // Everything created so far must be visible to the render thread
+    glFinish();
+    glfwMakeContextCurrent(thread->uploadWindow);
+    _O2D_threadHasUploadContext = true;
+    renderer->renderThread = thread;
+    _O2D_UpdateStreaming(renderer);
+    if (pthread_create(&thread->thread, NULL, _O2D_RenderThreadMain, renderer) != 0) {
+        printf("Could not create the render thread.\n");
+        renderer->renderThread = NULL;
+        _O2D_UpdateStreaming(renderer);
+        _O2D_threadHasUploadContext = false;
+        glfwMakeContextCurrent(renderer->window);
+        glfwDestroyWindow(thread->uploadWindow);
+        pthread_mutex_destroy(&thread->mutex);
+        pthread_cond_destroy(&thread->cond);
+        _O2D_Free(thread);
+        return false;
+    }
+    return true;
+}
+
+void O2D_StopRenderThread(O2D_Renderer *renderer) {
+    O2D_RenderThread *thread = renderer->renderThread;
+    if (thread == NULL)
+        return;
+    // A frame that was already queued still gets submitted
+    pthread_mutex_lock(&thread->mutex);
+    thread->quit = true;
+    pthread_cond_broadcast(&thread->cond);
+    pthread_mutex_unlock(&thread->mutex);
+    pthread_join(thread->thread, NULL);
+
+    renderer->renderThread = NULL;
+    _O2D_UpdateStreaming(renderer);
+    renderer->frameLimiter.deadline = 0;
+    _O2D_threadHasUploadContext = false;
+    glfwMakeContextCurrent(renderer->window);
+    glfwDestroyWindow(thread->uploadWindow);
+    glViewport(0, 0, renderer->framebufferWidth, renderer->framebufferHeight);
+    glClearColor(renderer->clearColor[0], renderer->clearColor[1],
+                 renderer->clearColor[2], renderer->clearColor[3]);
+    pthread_mutex_destroy(&thread->mutex);
+    pthread_cond_destroy(&thread->cond);
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        _O2D_Free(thread->streams[i].vtxBuf.vertices);
+        _O2D_Free(thread->streams[i].spriteBuf.sprites);
+        _O2D_Free(thread->streams[i].batches);
+    }
+    _O2D_Free(thread);
+}
+
+void *_O2D_RenderThreadMain(void *arg) {
+    O2D_Renderer *renderer = arg;
+    O2D_RenderThread *thread = renderer->renderThread;
+    glfwMakeContextCurrent(renderer->window);
+    pthread_mutex_lock(&thread->mutex);
+    for (;;) {
+        while (!thread->submitted && !thread->quit)
+            pthread_cond_wait(&thread->cond, &thread->mutex);
+        if (!thread->submitted)
+            break;
+        pthread_mutex_unlock(&thread->mutex);
+
+        O2D_ZONE_BEGIN("Render thread frame");
+        if (thread->swapInterval != thread->appliedSwapInterval) {
+            // Back to -1 only after a replay changed it
+            glfwSwapInterval(thread->swapInterval >= 0 ? thread->swapInterval : renderer->defaultSwapInterval);
+            thread->appliedSwapInterval = thread->swapInterval;
+        }
+        if (thread->framebufferWidth != thread->viewportWidth || thread->framebufferHeight != thread->viewportHeight) {
+            thread->viewportWidth = thread->framebufferWidth;
+            thread->viewportHeight = thread->framebufferHeight;
+            glViewport(0, 0, thread->viewportWidth, thread->viewportHeight);
+        }
+        glClearColor(thread->clearColor[0], thread->clearColor[1],
+                     thread->clearColor[2], thread->clearColor[3]);
+        if (!thread->dirtyRects) {
+            if (renderer->dirty.framebuffer != 0)
+                _O2D_ReleaseDirtyRects(renderer);
+            _O2D_ClearFrame(renderer, thread->depthSorting);
+        }
+        _O2D_BeginGpuFrame(renderer, thread->frameIndex, thread->gpuTiming);
+        _O2D_BeginOverdrawFrame(renderer, thread->viewportWidth, thread->viewportHeight, thread->overdrawProfiling);
+        uint64_t allocationBase = _O2D_threadAllocationNum;
+        if (thread->dirtyRects)
+            thread->elidedBytes = _O2D_SubmitDirtyFrame(renderer, thread->streams, thread->viewProjMatrix,
+                                                        thread->clearColor, thread->submitMode, &thread->bufferPolicy,
+                                                        thread->depthSorting, thread->viewportWidth,
+                                                        thread->viewportHeight);
+        else
+            thread->elidedBytes = _O2D_SubmitBatches(renderer, thread->streams, thread->viewProjMatrix,
+                                                     thread->submitMode, &thread->bufferPolicy);
+        thread->allocationNum = (uint32_t)(_O2D_threadAllocationNum - allocationBase);
+        _O2D_EndGpuFrame(renderer);
+        _O2D_EndOverdrawFrame(renderer, thread->frameIndex);
+        _O2D_PaceFrame(&thread->frameLimiter);
+        O2D_ZONE_BEGIN("glfwSwapBuffers");
+        glfwSwapBuffers(renderer->window);
+        O2D_ZONE_END("glfwSwapBuffers");
+        O2D_ZONE_END("Render thread frame");
+
+        pthread_mutex_lock(&thread->mutex);
+        thread->submitted = false;
+        pthread_cond_broadcast(&thread->cond);
+    }
+    pthread_mutex_unlock(&thread->mutex);
+    glfwMakeContextCurrent(0);
+    return NULL;
+}
+
+void O2D_SetFrameLimit(O2D_Renderer *renderer, double framesPerSecond) {
+    renderer->frameLimiter.targetTime = framesPerSecond > 0.0 ? (uint64_t)(1e9 / framesPerSecond) : 0;
+    renderer->frameLimiter.deadline = 0;
+}
+
+void O2D_FrameClockStart(O2D_FrameClock *clock) {
+    clock->startTime = clock->lastTime = _O2D_GetTimeNs();
+    clock->deltaTime = 0;
+    clock->elapsed = 0;
+}
+
+void O2D_FrameClockTick(O2D_FrameClock *clock) {
+    uint64_t now = _O2D_GetTimeNs();
+    clock->deltaTime = now - clock->lastTime;
+    clock->elapsed = now - clock->startTime;
+    clock->lastTime = now;
+}
+
+double O2D_FrameClockDelta(const O2D_FrameClock *clock) {
+    return clock->deltaTime / 1e6;
+}
+
+bool O2D_FixedTimestepInit(O2D_FixedTimestep *timestep, double step, uint32_t maxSteps) {
+    O2D_ZeroMem(timestep, sizeof(O2D_FixedTimestep));
+    // Also rejects NaN and steps below a nanosecond
+    if (!(step * 1e6 >= 1.0)) {
+        printf("Fixed timestep of %f ms is not positive.\n", step);
+        return false;
+    }
+    timestep->step = (uint64_t)(step * 1e6);
+    timestep->maxSteps = maxSteps;
+    return true;
+}
+
+void O2D_FixedTimestepAdvance(O2D_FixedTimestep *timestep, uint64_t deltaTime) {
+    timestep->accumulator += deltaTime;
+    timestep->stepNum = 0;
+    // Don't try to catch up with more than maxSteps, it only makes the next frame slower
+    if (timestep->maxSteps > 0 && timestep->accumulator > timestep->step * timestep->maxSteps)
+        timestep->accumulator = timestep->step * timestep->maxSteps;
+}
+
+bool O2D_FixedTimestepStep(O2D_FixedTimestep *timestep) {
+    // A step of 0 was rejected by O2D_FixedTimestepInit()
+    if (timestep->step == 0 || timestep->accumulator < timestep->step)
+        return false;
+    timestep->accumulator -= timestep->step;
+    timestep->stepNum++;
+    return true;
+}
+
+double O2D_FixedTimestepAlpha(const O2D_FixedTimestep *timestep) {
+    return timestep->step ? (double)timestep->accumulator / timestep->step : 0.0;
+}
+
+bool O2D_TraceDump(const char *path) {
+#ifdef O2D_ENABLE_TRACE
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Could not open trace file %s.\n", path);
+        return false;
+    }
+    fprintf(file, "{\"traceEvents\":[\n");
+    _O2D_TraceWriteEvents(file, 0, true);
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+void _O2D_TraceEvent(const char *name, char phase) {
+#ifdef O2D_ENABLE_TRACE
+    O2D_TraceBuffer *buffer = _O2D_threadTraceBuffer;
+    if (buffer == NULL) {
+        if (_O2D_threadTraceFull)
+            return;
+        uint32_t index = atomic_fetch_add(&_O2D_traceBufferNum, 1);
+        if (index >= O2D_TRACE_MAX_THREADS) {
+            _O2D_threadTraceFull = true;
+            return;
+        }
+        buffer = _O2D_Calloc(1, sizeof(O2D_TraceBuffer));
+        buffer->threadId = index;
+        _O2D_threadTraceBuffer = buffer;
+        // Published last, the reader skips empty entries
+        atomic_store_explicit(&_O2D_traceBuffers[index], buffer, memory_order_release);
+    }
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    O2D_TraceSlot *slot = &buffer->slots[head % O2D_TRACE_RING_SIZE];
+    atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->name, name, memory_order_relaxed);
+    atomic_store_explicit(&slot->time, _O2D_GetTimeNs(), memory_order_relaxed);
+    atomic_store_explicit(&slot->phase, phase, memory_order_relaxed);
+    atomic_store_explicit(&slot->sequence, head + 1, memory_order_release);
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+#else
+    (void)name;
+    (void)phase;
+#endif
+}
+
+uint32_t _O2D_TraceWriteEvents(FILE *file, uint64_t since, bool first) {
+    uint32_t written = 0;
+#ifdef O2D_ENABLE_TRACE
+    static O2D_TraceRecord records[O2D_TRACE_RING_SIZE]; // Not reentrant, dump from one thread
+    uint32_t bufferNum = atomic_load(&_O2D_traceBufferNum);
+    if (bufferNum > O2D_TRACE_MAX_THREADS)
+        bufferNum = O2D_TRACE_MAX_THREADS;
+    for (uint32_t i = 0; i < bufferNum; i++) {
+        O2D_TraceBuffer *buffer = atomic_load_explicit(&_O2D_traceBuffers[i], memory_order_acquire);
+        if (buffer == NULL)
+            continue;
+        uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+        uint64_t tail = head > O2D_TRACE_RING_SIZE ? head - O2D_TRACE_RING_SIZE : 0;
+        uint32_t recordNum = 0;
+        for (uint64_t j = tail; j < head; j++) {
+            O2D_TraceSlot *slot = &buffer->slots[j % O2D_TRACE_RING_SIZE];
+            uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+            O2D_TraceRecord *record = &records[recordNum];
+            record->name = atomic_load_explicit(&slot->name, memory_order_relaxed);
+            record->time = atomic_load_explicit(&slot->time, memory_order_relaxed);
+            record->phase = atomic_load_explicit(&slot->phase, memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            // Being rewritten, rewritten while copying or already holding a newer event. What came
+            // before it is dropped too, so the dump stays a contiguous run of events
+            if (sequence == j + 1 && atomic_load_explicit(&slot->sequence, memory_order_relaxed) == sequence)
+                recordNum++;
+            else
+                recordNum = 0;
+        }
+        for (uint32_t j = 0; j < recordNum; j++) {
+            O2D_TraceRecord *record = &records[j];
+            if (record->time < since)
+                continue;
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                    first ? "" : ",\n", record->name, record->phase, record->time / 1e3, buffer->threadId);
+            first = false;
+            written++;
+        }
+    }
+#else
+    (void)file;
+    (void)since;
+    (void)first;
+#endif
+    return written;
+}
+
+uint64_t _O2D_GetTimeNs(void) {
+#ifdef _WIN32
+    return (uint64_t)(glfwGetTimerValue() * (1e9 / glfwGetTimerFrequency()));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+void _O2D_SleepNs(uint64_t duration) {
+#ifdef _WIN32
+    Sleep((DWORD)(duration / 1000000));
+#else
+    struct timespec ts = { (time_t)(duration / 1000000000ull), (long)(duration % 1000000000ull) };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+void _O2D_PaceFrame(O2D_FrameLimiter *limiter) {
+    if (limiter->targetTime == 0)
+        return;
+    uint64_t now = _O2D_GetTimeNs();
+    // Deadlines advance by whole frames so the error doesn't accumulate, unless we fell behind
+    if (limiter->deadline == 0 || now > limiter->deadline + limiter->targetTime) {
+        limiter->deadline = now + limiter->targetTime;
+        return;
+    }
+    O2D_ZONE_BEGIN("_O2D_PaceFrame");
+    while (now + limiter->spinTime < limiter->deadline) {
+        _O2D_SleepNs(limiter->deadline - now - limiter->spinTime);
+        now = _O2D_GetTimeNs();
+    }
+    while (now < limiter->deadline)
+        now = _O2D_GetTimeNs();
+    limiter->deadline += limiter->targetTime;
+    O2D_ZONE_END("_O2D_PaceFrame");
+}
+
+void _O2D_BeginGpuFrame(O2D_Renderer *renderer, uint64_t frameIndex, bool enable) {
+    O2D_GpuTimers *timers = &renderer->gpuTimers;
+    if (!enable) {
+        _O2D_ReleaseGpuTimers(renderer);
+        return;
+    }
+    if (!timers->created) {
+        for (uint32_t i = 0; i < O2D_GPU_TIMER_FRAMES; i++)
+            glGenQueries(sizeof(timers->frames[i].queries) / sizeof(uint32_t), timers->frames[i].queries);
+        timers->created = true;
+    }
+    timers->current = (timers->current + 1) % O2D_GPU_TIMER_FRAMES;
+    O2D_GpuTimerFrame *frame = &timers->frames[timers->current];
+    // The slot about to be reused is the oldest one, so its results are the most likely to be ready
+    if (frame->pending)
+        _O2D_CollectGpuFrame(renderer, frame);
+    frame->frameIndex = frameIndex;
+    frame->batchNum = 0;
+    frame->open = true;
+    glQueryCounter(frame->queries[0], GL_TIMESTAMP);
+}
+
+void _O2D_EndGpuFrame(O2D_Renderer *renderer) {
+    O2D_GpuTimerFrame *frame = &renderer->gpuTimers.frames[renderer->gpuTimers.current];
+    if (!frame->open)
+        return;
+    glQueryCounter(frame->queries[1], GL_TIMESTAMP);
+    frame->open = false;
+    frame->pending = true;
+}
+
+void _O2D_CollectGpuFrame(O2D_Renderer *renderer, O2D_GpuTimerFrame *frame) {
+    frame->pending = false;
+    // Queries complete in order, so if the last one is ready all of them are
+    int32_t available = 0;
+    glGetQueryObjectiv(frame->queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        renderer->gpuTimers.droppedFrames++;
+        return;
+    }
+    uint64_t begin, end;
+    O2D_GpuTimers *timers = &renderer->gpuTimers;
+    glGetQueryObjectui64v(frame->queries[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(frame->queries[1], GL_QUERY_RESULT, &end);
+    timers->resultFrameIndex = frame->frameIndex;
+    timers->resultTime = (end - begin) / 1e6;
+    timers->resultBatchNum = frame->batchNum;
+    for (uint32_t i = 0; i < frame->batchNum; i++) {
+        glGetQueryObjectui64v(frame->queries[2 + 2 * i], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame->queries[3 + 2 * i], GL_QUERY_RESULT, &end);
+        timers->resultBatchTimes[i] = (end - begin) / 1e6;
+    }
+}
+
+void _O2D_ReleaseGpuTimers(O2D_Renderer *renderer) {
+    O2D_GpuTimers *timers = &renderer->gpuTimers;
+    if (!timers->created)
+        return;
+    for (uint32_t i = 0; i < O2D_GPU_TIMER_FRAMES; i++) {
+        glDeleteQueries(sizeof(timers->frames[i].queries) / sizeof(uint32_t), timers->frames[i].queries);
+        timers->frames[i].open = false;
+        timers->frames[i].pending = false;
+    }
+    timers->created = false;
+}
+
+void _O2D_CopyGpuResults(O2D_Renderer *renderer, O2D_FrameStats *stats) {
+    O2D_GpuTimers *timers = &renderer->gpuTimers;
+    stats->gpuFrameIndex = timers->resultFrameIndex;
+    stats->gpuTime = timers->resultTime;
+    stats->timedBatchNum = timers->resultBatchNum;
+    memcpy(stats->gpuBatchTimes, timers->resultBatchTimes, sizeof(stats->gpuBatchTimes));
+}
+
+void _O2D_BeginOverdrawFrame(O2D_Renderer *renderer, uint16_t width, uint16_t height, bool enable) {
+    O2D_OverdrawProfiler *overdraw = &renderer->overdraw;
+    overdraw->active = enable;
+    if (!enable) {
+        // The heatmap stays, so the last report can still be shown
+        if (overdraw->counterTexture != 0) {
+            glDeleteTextures(1, &overdraw->counterTexture);
+            overdraw->counterTexture = 0;
+            _O2D_Free(overdraw->counts);
+            _O2D_Free(overdraw->pixels);
+            overdraw->counts = NULL;
+            overdraw->pixels = NULL;
+        }
+        return;
+    }
+    if (overdraw->counterTexture == 0 || overdraw->width != width || overdraw->height != height) {
+        glDeleteTextures(1, &overdraw->counterTexture);
+        glDeleteTextures(1, &overdraw->result.heatmap);
+        overdraw->width = width;
+        overdraw->height = height;
+        glCreateTextures(GL_TEXTURE_2D, 1, &overdraw->counterTexture);
+        glTextureStorage2D(overdraw->counterTexture, 1, GL_R32UI, width, height);
+        glCreateTextures(GL_TEXTURE_2D, 1, &overdraw->result.heatmap);
+        glTextureParameteri(overdraw->result.heatmap, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(overdraw->result.heatmap, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTextureStorage2D(overdraw->result.heatmap, 1, GL_RGBA8, width, height);
+        overdraw->counts = _O2D_Realloc(overdraw->counts, (size_t)width * height * sizeof(uint32_t));
+        overdraw->pixels = _O2D_Realloc(overdraw->pixels, (size_t)width * height * 4);
+    }
+    uint32_t zero = 0;
+    glClearTexImage(overdraw->counterTexture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindImageTexture(0, overdraw->counterTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+}
+
+void _O2D_EndOverdrawFrame(O2D_Renderer *renderer, uint64_t frameIndex) {
+    O2D_OverdrawProfiler *overdraw = &renderer->overdraw;
+    if (!overdraw->active)
+        return;
+    O2D_ZONE_BEGIN("_O2D_EndOverdrawFrame");
+    uint32_t pixelNum = (uint32_t)overdraw->width * overdraw->height;
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glGetTextureImage(overdraw->counterTexture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                      pixelNum * sizeof(uint32_t), overdraw->counts);
+    // Black for untouched pixels, then blue, green, yellow, red and white at 1, 2, 4, 8 and 16 fragments
+    static const uint32_t stops[6] = { 0, 1, 2, 4, 8, 16 };
+    static const uint8_t colors[6][3] = { { 0, 0, 0 }, { 0, 0, 255 }, { 0, 255, 0 },
+                                          { 255, 255, 0 }, { 255, 0, 0 }, { 255, 255, 255 } };
+    O2D_OverdrawReport *report = &overdraw->result;
+    O2D_ZeroMem(report->histogram, sizeof(report->histogram));
+    report->peak = 0;
+    report->fragmentNum = 0;
+    uint32_t coveredNum = 0;
+    for (uint32_t i = 0; i < pixelNum; i++) {
+        uint32_t count = overdraw->counts[i];
+        report->histogram[count < O2D_OVERDRAW_BUCKETS ? count : O2D_OVERDRAW_BUCKETS - 1]++;
+        report->fragmentNum += count;
+        if (count > report->peak)
+            report->peak = count;
+        if (count > 0)
+            coveredNum++;
+        uint8_t *pixel = &overdraw->pixels[i * 4];
+        uint8_t stop = 1;
+        while (stop < 5 && count > stops[stop])
+            stop++;
+        float t = count >= stops[5] ? 1.0f : (float)(count - stops[stop - 1]) / (stops[stop] - stops[stop - 1]);
+        for (uint8_t j = 0; j < 3; j++)
+            pixel[j] = (uint8_t)(colors[stop - 1][j] + (colors[stop][j] - colors[stop - 1][j]) * t);
+        pixel[3] = 255;
+    }
+    glTextureSubImage2D(report->heatmap, 0, 0, 0, overdraw->width, overdraw->height, GL_RGBA,
+                        GL_UNSIGNED_BYTE, overdraw->pixels);
+    report->average = coveredNum > 0 ? (double)report->fragmentNum / coveredNum : 0.0;
+    report->frameIndex = frameIndex;
+    report->width = overdraw->width;
+    report->height = overdraw->height;
+    O2D_ZONE_END("_O2D_EndOverdrawFrame");
+}
+
+void _O2D_ReleaseOverdrawProfiler(O2D_Renderer *renderer) {
+    O2D_OverdrawProfiler *overdraw = &renderer->overdraw;
+    glDeleteTextures(1, &overdraw->counterTexture);
+    glDeleteTextures(1, &overdraw->result.heatmap);
+    _O2D_Free(overdraw->counts);
+    _O2D_Free(overdraw->pixels);
+    O2D_ZeroMem(overdraw, sizeof(O2D_OverdrawProfiler));
+    renderer->overdrawReport.heatmap = 0;
+}
+
+void _O2D_DrawTimed(O2D_Renderer *renderer, uint32_t firstVertex, uint32_t vertexNum) {
+    bool timed = _O2D_BeginTimedDraw(renderer);
+    glDrawArrays(GL_TRIANGLES, firstVertex, vertexNum);
+    if (timed)
+        _O2D_EndTimedDraw(renderer);
+}
+
+bool _O2D_BeginTimedDraw(O2D_Renderer *renderer) {
+    O2D_GpuTimerFrame *timerFrame = &renderer->gpuTimers.frames[renderer->gpuTimers.current];
+    if (!timerFrame->open || timerFrame->batchNum >= O2D_MAX_TIMED_BATCHES)
+        return false;
+    glQueryCounter(timerFrame->queries[2 + 2 * timerFrame->batchNum], GL_TIMESTAMP);
+    return true;
+}
+
+void _O2D_EndTimedDraw(O2D_Renderer *renderer) {
+    O2D_GpuTimerFrame *timerFrame = &renderer->gpuTimers.frames[renderer->gpuTimers.current];
+    glQueryCounter(timerFrame->queries[3 + 2 * timerFrame->batchNum], GL_TIMESTAMP);
+    timerFrame->batchNum++;
+}
+
+void _O2D_CloseBatch(O2D_Renderer *renderer) {
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++)
+        _O2D_CloseStreamBatch(renderer, &renderer->streams[i]);
+}
+
+void _O2D_CloseStreamBatch(O2D_Renderer *renderer, O2D_BatchStream *stream) {
+    uint32_t firstVertex = stream->batchFirstVertex;
+    uint32_t streamEnd = stream->vertexFormat == O2D_VERTEX_FORMAT_SPRITE ?
+        stream->spriteBuf.number * 6 : stream->vtxBuf.number;
+    if (streamEnd > firstVertex) {
+        if (stream->batchNum == stream->batchCapacity) {
+            stream->batchCapacity = stream->batchCapacity ? stream->batchCapacity * 2 : 8;
+            stream->batches = _O2D_Realloc(stream->batches, stream->batchCapacity * sizeof(O2D_Batch));
+        }
+        O2D_Batch *batch = &stream->batches[stream->batchNum++];
+        batch->firstVertex = firstVertex;
+        batch->vertexNum = streamEnd - firstVertex;
+        batch->usedSlots = stream->textureSlots.usedSlots;
+        for (uint16_t i = 0; i < batch->usedSlots; i++)
+            batch->textures[i] = stream->textureSlots.slots[i];
+        renderer->stats.batchNum++;
+        batch->state = renderer->state;
+        batch->state.vertexFormat = stream->vertexFormat;
+        batch->state.depthTest = renderer->depthSorting;
+        batch->state.depthWrite = stream == &renderer->streams[O2D_PASS_OPAQUE];
+        if (batch->state.depthWrite)
+            batch->state.blending = false;
+        renderer->stats.vertexNum += batch->vertexNum;
+    }
+    stream->batchFirstVertex = streamEnd;
+    stream->textureSlots.usedSlots = 0;
+}
+
+O2D_BatchStream *_O2D_SelectStream(O2D_Renderer *renderer, uint32_t texture, float alpha) {
+    // Without blending the result doesn't depend on what is behind, so it can be drawn in any order
+    if (renderer->depthSorting && (!renderer->state.blending ||
+        (alpha >= 1.0f && renderer->state.tint[3] >= 1.0f && _O2D_TextureIsOpaque(texture))))
+        return &renderer->streams[O2D_PASS_OPAQUE];
+    return &renderer->streams[O2D_PASS_ORDERED];
+}
+
+void _O2D_SetBatchFormat(O2D_Renderer *renderer, O2D_BatchStream *stream, uint8_t vertexFormat) {
+    if (stream->vertexFormat == vertexFormat)
+        return;
+    _O2D_CloseStreamBatch(renderer, stream);
+    stream->vertexFormat = vertexFormat;
+    stream->batchFirstVertex = vertexFormat == O2D_VERTEX_FORMAT_SPRITE ?
+        stream->spriteBuf.number * 6 : stream->vtxBuf.number;
+}
+
+int16_t _O2D_GetTextureSlot(O2D_Renderer *renderer, O2D_BatchStream *stream, uint32_t texture) {
+    O2D_TextureSlotBuffer *textureSlots = &stream->textureSlots;
+    // Check if texture already exists in the current batch
+    int16_t texSlot = _O2D_FindTextureSlot(stream, texture);
+    if (texSlot >= 0)
+        return texSlot;
+    // If the texture slots are full, close the batch and keep appending to the same
+    // stream with a new slot table. Everything is drawn at the end of the frame
+    if (textureSlots->usedSlots >= textureSlots->slotNum)
+        _O2D_CloseStreamBatch(renderer, stream);
+    texSlot = textureSlots->usedSlots++;
+    textureSlots->slots[texSlot] = texture;
+    return texSlot;
+}
+
+
+void _O2D_FinishStreams(O2D_Renderer *renderer) {
+    _O2D_CloseBatch(renderer);
+    // Depth testing makes the order of the opaque pass free, front to back lets it reject the most
+    _O2D_ReverseStream(&renderer->streams[O2D_PASS_OPAQUE]);
+}
+
+void _O2D_ReverseStream(O2D_BatchStream *stream) {
+    // Triangles and sprites swap places, so the range of every batch gets mirrored
+    O2D_Vertex *vertices = stream->vtxBuf.vertices;
+    for (uint32_t i = 0, j = stream->vtxBuf.number; i + 3 < j; i += 3, j -= 3) {
+        O2D_Vertex triangle[3];
+        memcpy(triangle, &vertices[i], sizeof(triangle));
+        memcpy(&vertices[i], &vertices[j - 3], sizeof(triangle));
+        memcpy(&vertices[j - 3], triangle, sizeof(triangle));
+    }
+    O2D_SpriteRecord *sprites = stream->spriteBuf.sprites;
+    for (uint32_t i = 0, j = stream->spriteBuf.number; i + 1 < j; i++, j--) {
+        O2D_SpriteRecord sprite = sprites[i];
+        sprites[i] = sprites[j - 1];
+        sprites[j - 1] = sprite;
+    }
+    for (uint32_t i = 0, j = stream->batchNum; i + 1 < j; i++, j--) {
+        O2D_Batch batch = stream->batches[i];
+        stream->batches[i] = stream->batches[j - 1];
+        stream->batches[j - 1] = batch;
+    }
+    for (uint32_t i = 0; i < stream->batchNum; i++) {
+        O2D_Batch *batch = &stream->batches[i];
+        uint32_t streamEnd = batch->state.vertexFormat == O2D_VERTEX_FORMAT_SPRITE ?
+            stream->spriteBuf.number * 6 : stream->vtxBuf.number;
+        batch->firstVertex = streamEnd - batch->firstVertex - batch->vertexNum;
+    }
+}
+
+void _O2D_ResetStream(O2D_BatchStream *stream) {
+    stream->vtxBuf.number = 0;
+    stream->spriteBuf.number = 0;
+    stream->batchFirstVertex = 0;
+    stream->batchNum = 0;
+    stream->textureSlots.usedSlots = 0;
+}
+
+bool _O2D_StreamsEmpty(const O2D_BatchStream *streams) {
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        if (streams[i].batchNum > 0)
+            return false;
+    }
+    return true;
+}
+
+void _O2D_ClearFrame(O2D_Renderer *renderer, bool depth) {
+    if (depth) {
+        // glClear() respects the depth mask
+        _O2D_SetDepthState(renderer, renderer->stateCache.depthTest == 1, true);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    else {
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+}
+
+uint64_t _O2D_SubmitBatches(O2D_Renderer *renderer, const O2D_BatchStream *streams, const float viewProj[16],
+                            uint8_t submitMode, const O2D_BufferPolicy *policy) {
+    if (_O2D_StreamsEmpty(streams))
+        return 0;
+    O2D_ZONE_BEGIN("_O2D_SubmitBatches upload");
+    // The passes go one after the other in the same buffers
+    uint32_t vertexBases[O2D_PASS_NUM], spriteBases[O2D_PASS_NUM];
+    uint32_t vertexNum = 0, spriteNum = 0;
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        vertexBases[i] = vertexNum;
+        spriteBases[i] = spriteNum;
+        vertexNum += streams[i].vtxBuf.number;
+        spriteNum += streams[i].spriteBuf.number;
+    }
+    if (policy->maxVertices > 0 && (vertexNum > policy->maxVertices || spriteNum > policy->maxVertices / 6)) {
+        O2D_ZONE_END("_O2D_SubmitBatches upload");
+        _O2D_SubmitBatchesChunked(renderer, streams, viewProj, policy->maxVertices);
+        return 0;
+    }
+    uint64_t elidedBytes = 0;
+    uint32_t vboCapacity = _O2D_DecayCapacity(policy, &renderer->vboUsage, vertexNum, renderer->vboCapacity);
+    vboCapacity = _O2D_GrowCapacity(policy, vertexNum, vboCapacity);
+    if (vboCapacity != renderer->vboCapacity) {
+        renderer->vboCapacity = vboCapacity;
+        _O2D_BindArrayBuffer(renderer, renderer->VBO);
+        glBufferData(GL_ARRAY_BUFFER, vboCapacity * sizeof(O2D_Vertex), NULL, GL_DYNAMIC_DRAW);
+        for (uint8_t i = 0; i < O2D_PASS_NUM; i++)
+            renderer->resident[i].vertexNum = 0;
+    }
+    if (vertexNum > 0) {
+        _O2D_BindArrayBuffer(renderer, renderer->VBO);
+        for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+            uint32_t number = streams[i].vtxBuf.number;
+            if (number == 0)
+                continue;
+            O2D_ResidentPass *resident = &renderer->resident[i];
+            uint64_t hash = policy->elideUploads ? _O2D_HashBuffer(streams[i].vtxBuf.vertices,
+                                                                   number * sizeof(O2D_Vertex)) : 0;
+            if (policy->elideUploads && resident->vertexNum == number && resident->vertexBase == vertexBases[i] &&
+                resident->vertexHash == hash) {
+                elidedBytes += number * sizeof(O2D_Vertex);
+                continue;
+            }
+            glBufferSubData(GL_ARRAY_BUFFER, vertexBases[i] * sizeof(O2D_Vertex), number * sizeof(O2D_Vertex),
+                            streams[i].vtxBuf.vertices);
+            // Without elision nothing is hashed, and nothing can match later
+            for (uint8_t j = 0; j < O2D_PASS_NUM; j++) {
+                O2D_ResidentPass *other = &renderer->resident[j];
+                if (other->vertexBase < vertexBases[i] + number && vertexBases[i] < other->vertexBase + other->vertexNum)
+                    other->vertexNum = 0;
+            }
+            resident->vertexHash = hash;
+            resident->vertexBase = vertexBases[i];
+            resident->vertexNum = policy->elideUploads ? number : 0;
+        }
+    }
+    O2D_BufferPolicy spritePolicy = *policy;
+    spritePolicy.maxVertices /= 6;
+    uint32_t spriteSSBOCapacity = _O2D_DecayCapacity(&spritePolicy, &renderer->spriteSSBOUsage, spriteNum,
+                                                     renderer->spriteSSBOCapacity);
+    spriteSSBOCapacity = _O2D_GrowCapacity(&spritePolicy, spriteNum, spriteSSBOCapacity);
+    if (spriteSSBOCapacity != renderer->spriteSSBOCapacity) {
+        renderer->spriteSSBOCapacity = spriteSSBOCapacity;
+        glNamedBufferData(renderer->spriteSSBO, spriteSSBOCapacity * sizeof(O2D_SpriteRecord), NULL, GL_DYNAMIC_DRAW);
+        for (uint8_t i = 0; i < O2D_PASS_NUM; i++)
+            renderer->resident[i].spriteNum = 0;
+    }
+    if (spriteNum > 0) {
+        for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+            uint32_t number = streams[i].spriteBuf.number;
+            if (number == 0)
+                continue;
+            O2D_ResidentPass *resident = &renderer->resident[i];
+            uint64_t hash = policy->elideUploads ? _O2D_HashBuffer(streams[i].spriteBuf.sprites,
+                                                                   number * sizeof(O2D_SpriteRecord)) : 0;
+            if (policy->elideUploads && resident->spriteNum == number && resident->spriteBase == spriteBases[i] &&
+                resident->spriteHash == hash) {
+                elidedBytes += number * sizeof(O2D_SpriteRecord);
+                continue;
+            }
+            glNamedBufferSubData(renderer->spriteSSBO, spriteBases[i] * sizeof(O2D_SpriteRecord),
+                                 number * sizeof(O2D_SpriteRecord), streams[i].spriteBuf.sprites);
+            for (uint8_t j = 0; j < O2D_PASS_NUM; j++) {
+                O2D_ResidentPass *other = &renderer->resident[j];
+                if (other->spriteBase < spriteBases[i] + number && spriteBases[i] < other->spriteBase + other->spriteNum)
+                    other->spriteNum = 0;
+            }
+            resident->spriteHash = hash;
+            resident->spriteBase = spriteBases[i];
+            resident->spriteNum = policy->elideUploads ? number : 0;
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, renderer->spriteSSBO);
+    }
+    O2D_ZONE_END("_O2D_SubmitBatches upload");
+    O2D_ZONE_BEGIN("_O2D_SubmitBatches draw");
+    if (submitMode == O2D_SUBMIT_MULTI_DRAW_INDIRECT) {
+        _O2D_DrawBatchesIndirect(renderer, streams, vertexBases, spriteBases, viewProj);
+        O2D_ZONE_END("_O2D_SubmitBatches draw");
+        return elidedBytes;
+    }
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        for (uint32_t j = 0; j < streams[i].batchNum; j++) {
+            const O2D_Batch *batch = &streams[i].batches[j];
+            bool sprites = batch->state.vertexFormat == O2D_VERTEX_FORMAT_SPRITE;
+            _O2D_BindVertexArray(renderer, sprites ? renderer->spriteVAO : renderer->VAO);
+            _O2D_ApplyRenderState(renderer, &batch->state, viewProj);
+            for (uint16_t k = 0; k < batch->usedSlots; k++)
+                _O2D_BindTextureUnit(renderer, k, batch->textures[k]);
+            uint32_t base = sprites ? spriteBases[i] * 6 : vertexBases[i];
+            _O2D_DrawTimed(renderer, base + batch->firstVertex, batch->vertexNum);
+        }
+    }
+    O2D_ZONE_END("_O2D_SubmitBatches draw");
+    return elidedBytes;
+}
+
+void _O2D_SubmitBatchesChunked(O2D_Renderer *renderer, const O2D_BatchStream *streams, const float viewProj[16],
+                               uint32_t maxVertices) {
+    O2D_ZONE_BEGIN("_O2D_SubmitBatchesChunked");
+    uint32_t maxSprites = maxVertices / 6;
+    // Both buffers stay at the cap while frames need chunks
+    if (renderer->vboCapacity != maxVertices) {
+        renderer->vboCapacity = maxVertices;
+        _O2D_BindArrayBuffer(renderer, renderer->VBO);
+        glBufferData(GL_ARRAY_BUFFER, maxVertices * sizeof(O2D_Vertex), NULL, GL_DYNAMIC_DRAW);
+    }
+    if (renderer->spriteSSBOCapacity != maxSprites) {
+        renderer->spriteSSBOCapacity = maxSprites;
+        glNamedBufferData(renderer->spriteSSBO, maxSprites * sizeof(O2D_SpriteRecord), NULL, GL_DYNAMIC_DRAW);
+    }
+    renderer->vboUsage = (O2D_BufferUsage){ 0 };
+    renderer->spriteSSBOUsage = (O2D_BufferUsage){ 0 };
+    O2D_ZeroMem(renderer->resident, sizeof(renderer->resident));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, renderer->spriteSSBO);
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        const O2D_BatchStream *stream = &streams[i];
+        // Range of the pass's vertices (sprites) in the buffer, empty until the first upload
+        uint32_t vertexWindow = 0, vertexWindowEnd = 0;
+        uint32_t spriteWindow = 0, spriteWindowEnd = 0;
+        for (uint32_t j = 0; j < stream->batchNum; j++) {
+            const O2D_Batch *batch = &stream->batches[j];
+            bool sprites = batch->state.vertexFormat == O2D_VERTEX_FORMAT_SPRITE;
+            _O2D_BindVertexArray(renderer, sprites ? renderer->spriteVAO : renderer->VAO);
+            _O2D_ApplyRenderState(renderer, &batch->state, viewProj);
+            for (uint16_t k = 0; k < batch->usedSlots; k++)
+                _O2D_BindTextureUnit(renderer, k, batch->textures[k]);
+            uint32_t first = batch->firstVertex, end = batch->firstVertex + batch->vertexNum;
+            while (first < end) {
+                uint32_t pieceEnd;
+                if (sprites) {
+                    uint32_t sprite = first / 6;
+                    if (sprite < spriteWindow || sprite >= spriteWindowEnd) {
+                        uint32_t number = stream->spriteBuf.number - sprite;
+                        number = number < maxSprites ? number : maxSprites;
+                        // Orphaned so draws still reading the previous window aren't waited for
+                        glNamedBufferData(renderer->spriteSSBO, maxSprites * sizeof(O2D_SpriteRecord), NULL,
+                                          GL_DYNAMIC_DRAW);
+                        glNamedBufferSubData(renderer->spriteSSBO, 0, number * sizeof(O2D_SpriteRecord),
+                                             &stream->spriteBuf.sprites[sprite]);
+                        spriteWindow = sprite;
+                        spriteWindowEnd = sprite + number;
+                    }
+                    pieceEnd = end < spriteWindowEnd * 6 ? end : spriteWindowEnd * 6;
+                    _O2D_DrawTimed(renderer, first - spriteWindow * 6, pieceEnd - first);
+                }
+                else {
+                    if (first < vertexWindow || first >= vertexWindowEnd) {
+                        uint32_t number = stream->vtxBuf.number - first;
+                        number = number < maxVertices ? number : maxVertices;
+                        _O2D_BindArrayBuffer(renderer, renderer->VBO);
+                        glBufferData(GL_ARRAY_BUFFER, maxVertices * sizeof(O2D_Vertex), NULL, GL_DYNAMIC_DRAW);
+                        glBufferSubData(GL_ARRAY_BUFFER, 0, number * sizeof(O2D_Vertex),
+                                        &stream->vtxBuf.vertices[first]);
+                        vertexWindow = first;
+                        vertexWindowEnd = first + number;
+                    }
+                    pieceEnd = end < vertexWindowEnd ? end : vertexWindowEnd;
+                    _O2D_DrawTimed(renderer, first - vertexWindow, pieceEnd - first);
+                }
+                first = pieceEnd;
+            }
+        }
+    }
+    O2D_ZONE_END("_O2D_SubmitBatchesChunked");
+}
+
+void _O2D_DrawBatchesIndirect(O2D_Renderer *renderer, const O2D_BatchStream *streams,
+                              const uint32_t vertexBases[O2D_PASS_NUM], const uint32_t spriteBases[O2D_PASS_NUM],
+                              const float viewProj[16]) {
+    O2D_IndirectSubmit *indirect = &renderer->indirect;
+    uint32_t batchNum = 0;
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++)
+        batchNum += streams[i].batchNum;
+    if (batchNum > indirect->drawCapacity) {
+        indirect->drawCapacity = batchNum;
+        indirect->commands = _O2D_Realloc(indirect->commands, batchNum * sizeof(O2D_DrawArraysIndirectCommand));
+        indirect->drawParams = _O2D_Realloc(indirect->drawParams, batchNum * sizeof(O2D_DrawParams));
+        indirect->textureTable = _O2D_Realloc(indirect->textureTable, batchNum * O2D_MAX_TEX_SLOTS * sizeof(uint64_t));
+        indirect->batches = _O2D_Realloc(indirect->batches, batchNum * sizeof(O2D_Batch*));
+    }
+    if (indirect->commandBuffer == 0) {
+        glCreateBuffers(1, &indirect->commandBuffer);
+        glCreateBuffers(1, &indirect->drawParamBuffer);
+        glCreateBuffers(1, &indirect->textureTableBuffer);
+    }
+    // Draws are numbered across the passes, the pass order is kept
+    const O2D_Batch **batches = indirect->batches;
+    uint32_t drawNum = 0, textureNum = 0;
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        for (uint32_t j = 0; j < streams[i].batchNum; j++) {
+            const O2D_Batch *batch = &streams[i].batches[j];
+            uint32_t base = batch->state.vertexFormat == O2D_VERTEX_FORMAT_SPRITE ? spriteBases[i] * 6 : vertexBases[i];
+            indirect->commands[drawNum] =
+                (O2D_DrawArraysIndirectCommand){ batch->vertexNum, 1, base + batch->firstVertex, drawNum };
+            O2D_DrawParams *params = &indirect->drawParams[drawNum];
+            memcpy(params->tint, batch->state.tint, sizeof(params->tint));
+            params->alphaThreshold = batch->state.alphaThreshold;
+            params->firstTexture = textureNum;
+            params->textureNum = batch->usedSlots;
+            params->padding = 0;
+            for (uint16_t k = 0; k < batch->usedSlots; k++)
+                indirect->textureTable[textureNum++] = _O2D_GetTextureHandle(renderer, batch->textures[k]);
+            batches[drawNum++] = batch;
+        }
+    }
+    // Orphan the buffers every frame, the driver hands out fresh storage while the last frame is in flight
+    glNamedBufferData(indirect->commandBuffer, batchNum * sizeof(O2D_DrawArraysIndirectCommand),
+                      indirect->commands, GL_STREAM_DRAW);
+    glNamedBufferData(indirect->drawParamBuffer, batchNum * sizeof(O2D_DrawParams),
+                      indirect->drawParams, GL_STREAM_DRAW);
+    glNamedBufferData(indirect->textureTableBuffer, (textureNum ? textureNum : 1) * sizeof(uint64_t),
+                      indirect->textureTable, GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect->commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, indirect->drawParamBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, indirect->textureTableBuffer);
+
+    // Blending, depth and the vertex format are the only state that can't come from the SSBOs
+    for (uint32_t first = 0; first < batchNum;) {
+        const O2D_RenderState *state = &batches[first]->state;
+        uint32_t last = first + 1;
+        while (last < batchNum && batches[last]->state.blending == state->blending &&
+               batches[last]->state.depthTest == state->depthTest &&
+               batches[last]->state.depthWrite == state->depthWrite &&
+               batches[last]->state.vertexFormat == state->vertexFormat)
+            last++;
+        O2D_ShaderFeatures features = { streams[O2D_PASS_ORDERED].textureSlots.slotNum, state->vertexFormat,
+                                        O2D_SHADER_BINDLESS | (renderer->overdraw.active ? O2D_SHADER_OVERDRAW : 0) };
+        O2D_ShaderVariant *variant = _O2D_GetShaderVariant(renderer, features, true);
+        _O2D_UseProgram(renderer, variant->program);
+        if (!variant->uniformsValid || memcmp(variant->viewProj, viewProj, sizeof(variant->viewProj)) != 0) {
+            glUniformMatrix4fv(variant->viewProjLocation, 1, GL_FALSE, viewProj);
+            memcpy(variant->viewProj, viewProj, sizeof(variant->viewProj));
+            variant->uniformsValid = true;
+        }
+        _O2D_BindVertexArray(renderer, state->vertexFormat == O2D_VERTEX_FORMAT_SPRITE ?
+                             renderer->spriteVAO : renderer->VAO);
+        _O2D_SetBlendingState(renderer, state->blending);
+        _O2D_SetDepthState(renderer, state->depthTest, state->depthWrite);
+        bool timed = _O2D_BeginTimedDraw(renderer);
+        glMultiDrawArraysIndirect(GL_TRIANGLES, (void*)(first * sizeof(O2D_DrawArraysIndirectCommand)),
+                                  last - first, 0);
+        if (timed)
+            _O2D_EndTimedDraw(renderer);
+        first = last;
+    }
+}
+
+uint64_t _O2D_SubmitDirtyFrame(O2D_Renderer *renderer, const O2D_BatchStream *streams, const float viewProj[16],
+                               const float clearColor[4], uint8_t submitMode, const O2D_BufferPolicy *policy,
+                               bool depth, uint16_t width, uint16_t height) {
+    O2D_ZONE_BEGIN("_O2D_SubmitDirtyFrame");
+    O2D_DirtyTracker *dirty = &renderer->dirty;
+    _O2D_BindDirtyFramebuffer(renderer, width, height);
+    _O2D_CollectDirtyRects(renderer, streams, viewProj, clearColor, depth, width, height);
+    uint64_t elidedBytes = 0;
+    int32_t bounds[4] = { width, height, 0, 0 };
+    dirty->redrawnPixels = 0;
+    for (uint32_t i = 0; i < dirty->rectNum; i++) {
+        const int32_t *rect = dirty->rects[i];
+        dirty->redrawnPixels += (uint64_t)(rect[2] - rect[0]) * (rect[3] - rect[1]);
+        for (uint8_t j = 0; j < 2; j++) {
+            bounds[j] = rect[j] < bounds[j] ? rect[j] : bounds[j];
+            bounds[j + 2] = rect[j + 2] > bounds[j + 2] ? rect[j + 2] : bounds[j + 2];
+        }
+    }
+    if (dirty->redrawnPixels == (uint64_t)width * height) {
+        _O2D_ClearFrame(renderer, depth);
+        elidedBytes = _O2D_SubmitBatches(renderer, streams, viewProj, submitMode, policy);
+    }
+    else if (dirty->rectNum > 0) {
+        // Stencil 1 in the rectangles, 0 in the rest of their bounds. The batches are drawn once
+        // with the stencil test, scissored to the bounds
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(bounds[0], bounds[1], bounds[2] - bounds[0], bounds[3] - bounds[1]);
+        glClearStencil(0);
+        glClear(GL_STENCIL_BUFFER_BIT);
+        glClearStencil(1);
+        for (uint32_t i = 0; i < dirty->rectNum; i++) {
+            const int32_t *rect = dirty->rects[i];
+            glScissor(rect[0], rect[1], rect[2] - rect[0], rect[3] - rect[1]);
+            _O2D_ClearFrame(renderer, depth);
+            glClear(GL_STENCIL_BUFFER_BIT);
+        }
+        glClearStencil(0);
+        glScissor(bounds[0], bounds[1], bounds[2] - bounds[0], bounds[3] - bounds[1]);
+        glEnable(GL_STENCIL_TEST);
+        glStencilFunc(GL_EQUAL, 1, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        elidedBytes = _O2D_SubmitBatches(renderer, streams, viewProj, submitMode, policy);
+        glDisable(GL_STENCIL_TEST);
+        glDisable(GL_SCISSOR_TEST);
+    }
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++)
+        _O2D_CopyStream(&dirty->previous[i], &streams[i], policy);
+    memcpy(dirty->viewProj, viewProj, sizeof(dirty->viewProj));
+    memcpy(dirty->clearColor, clearColor, sizeof(dirty->clearColor));
+    dirty->depthSorting = depth;
+    dirty->valid = true;
+    dirty->pending = false;
+    _O2D_BlitDirtyFramebuffer(renderer);
+    O2D_ZONE_END("_O2D_SubmitDirtyFrame");
+    return elidedBytes;
+}
+
+void _O2D_CollectDirtyRects(O2D_Renderer *renderer, const O2D_BatchStream *streams, const float viewProj[16],
+                            const float clearColor[4], bool depth, uint16_t width, uint16_t height) {
+    O2D_DirtyTracker *dirty = &renderer->dirty;
+    dirty->rectNum = 0;
+    if (!dirty->valid || memcmp(dirty->viewProj, viewProj, sizeof(dirty->viewProj)) != 0 ||
+        memcmp(dirty->clearColor, clearColor, sizeof(dirty->clearColor)) != 0 || dirty->depthSorting != depth) {
+        const int32_t screen[4] = { 0, 0, width, height };
+        _O2D_AddDirtyRect(dirty, screen);
+        return;
+    }
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        // Both frames are walked in push order, primitives that match are skipped
+        O2D_PrimitiveCursor current = _O2D_FirstPrimitive(&streams[i]);
+        O2D_PrimitiveCursor previous = _O2D_FirstPrimitive(&dirty->previous[i]);
+        for (;;) {
+            bool currentLeft = current.batch < streams[i].batchNum;
+            bool previousLeft = previous.batch < dirty->previous[i].batchNum;
+            if (!currentLeft && !previousLeft)
+                break;
+            if (currentLeft && previousLeft && _O2D_PrimitivesMatch(&current, &previous)) {
+                _O2D_NextPrimitive(&current);
+                _O2D_NextPrimitive(&previous);
+                continue;
+            }
+            // The fewest pushed or gone before the two line up again, or one replaced by the other
+            uint32_t inserted = currentLeft ? 1 : 0, removed = previousLeft ? 1 : 0;
+            if (currentLeft && previousLeft) {
+                uint32_t insertNum = _O2D_FindPrimitive(current, &previous);
+                uint32_t removeNum = _O2D_FindPrimitive(previous, &current);
+                if (insertNum != UINT32_MAX && insertNum <= removeNum) {
+                    inserted = insertNum;
+                    removed = 0;
+                }
+                else if (removeNum != UINT32_MAX) {
+                    inserted = 0;
+                    removed = removeNum;
+                }
+            }
+            for (; inserted > 0; inserted--) {
+                _O2D_AddDirtyPrimitive(dirty, &current, viewProj, width, height);
+                _O2D_NextPrimitive(&current);
+            }
+            for (; removed > 0; removed--) {
+                _O2D_AddDirtyPrimitive(dirty, &previous, viewProj, width, height);
+                _O2D_NextPrimitive(&previous);
+            }
+            // Nothing left to find once everything is redrawn
+            const int32_t *rect = dirty->rects[0];
+            if (dirty->rectNum == 1 && rect[0] == 0 && rect[1] == 0 && rect[2] == width && rect[3] == height)
+                return;
+        }
+    }
+}
+
+O2D_PrimitiveCursor _O2D_FirstPrimitive(const O2D_BatchStream *stream) {
+    O2D_PrimitiveCursor cursor = { stream, 0, 0 };
+    while (cursor.batch < stream->batchNum && stream->batches[cursor.batch].vertexNum == 0)
+        cursor.batch++;
+    if (cursor.batch < stream->batchNum)
+        cursor.vertex = stream->batches[cursor.batch].firstVertex;
+    return cursor;
+}
+
+void _O2D_NextPrimitive(O2D_PrimitiveCursor *cursor) {
+    const O2D_BatchStream *stream = cursor->stream;
+    const O2D_Batch *batch = &stream->batches[cursor->batch];
+    cursor->vertex += batch->state.vertexFormat == O2D_VERTEX_FORMAT_SPRITE ? 6 : 3;
+    if (cursor->vertex < batch->firstVertex + batch->vertexNum)
+        return;
+    cursor->batch++;
+    while (cursor->batch < stream->batchNum && stream->batches[cursor->batch].vertexNum == 0)
+        cursor->batch++;
+    if (cursor->batch < stream->batchNum)
+        cursor->vertex = stream->batches[cursor->batch].firstVertex;
+}
+
+uint32_t _O2D_FindPrimitive(O2D_PrimitiveCursor from, const O2D_PrimitiveCursor *target) {
+    for (uint32_t steps = 1; steps <= O2D_DIRTY_LOOKAHEAD; steps++) {
+        _O2D_NextPrimitive(&from);
+        if (from.batch == from.stream->batchNum)
+            break;
+        if (_O2D_PrimitivesMatch(&from, target))
+            return steps;
+    }
+    return UINT32_MAX;
+}
+
+uint32_t _O2D_SlotTexture(const O2D_Batch *batch, uint32_t slot) {
+    return slot < batch->usedSlots ? batch->textures[slot] : O2D_NO_TEXTURE;
+}
+
+bool _O2D_PrimitivesMatch(const O2D_PrimitiveCursor *a, const O2D_PrimitiveCursor *b) {
+    const O2D_Batch *batchA = &a->stream->batches[a->batch], *batchB = &b->stream->batches[b->batch];
+    if (memcmp(&batchA->state, &batchB->state, sizeof(O2D_RenderState)) != 0)
+        return false;
+    // Every push gets the next depth. Without the depth test it changes no pixel, so it is left
+    // out and a push does not change all those after it
+    bool depth = batchA->state.depthTest || batchA->state.depthWrite;
+    if (batchA->state.vertexFormat == O2D_VERTEX_FORMAT_SPRITE) {
+        O2D_SpriteRecord spriteA = a->stream->spriteBuf.sprites[a->vertex / 6];
+        O2D_SpriteRecord spriteB = b->stream->spriteBuf.sprites[b->vertex / 6];
+        if (_O2D_SlotTexture(batchA, spriteA.textureSlot) != _O2D_SlotTexture(batchB, spriteB.textureSlot))
+            return false;
+        spriteA.textureSlot = spriteB.textureSlot = 0;
+        if (!depth)
+            spriteA.depth = spriteB.depth = 0.0f;
+        return memcmp(&spriteA, &spriteB, sizeof(O2D_SpriteRecord)) == 0;
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        O2D_Vertex vertexA = a->stream->vtxBuf.vertices[a->vertex + i];
+        O2D_Vertex vertexB = b->stream->vtxBuf.vertices[b->vertex + i];
+        if (_O2D_SlotTexture(batchA, (uint32_t)vertexA.textureSlot) !=
+            _O2D_SlotTexture(batchB, (uint32_t)vertexB.textureSlot))
+            return false;
+        vertexA.textureSlot = vertexB.textureSlot = 0.0f;
+        if (!depth)
+            vertexA.z = vertexB.z = 0.0f;
+        if (memcmp(&vertexA, &vertexB, sizeof(O2D_Vertex)) != 0)
+            return false;
+    }
+    return true;
+}
+
+void _O2D_AddDirtyPrimitive(O2D_DirtyTracker *dirty, const O2D_PrimitiveCursor *primitive, const float viewProj[16],
+                            uint16_t width, uint16_t height) {
+    const O2D_BatchStream *stream = primitive->stream;
+    float points[3][2];
+    uint8_t pointNum = 3;
+    if (stream->batches[primitive->batch].state.vertexFormat == O2D_VERTEX_FORMAT_SPRITE) {
+        // The circle the sprite turns in
+        const O2D_SpriteRecord *record = &stream->spriteBuf.sprites[primitive->vertex / 6];
+        float radius = 0.5f * sqrtf(record->width * record->width + record->height * record->height);
+        points[0][0] = record->x - radius;
+        points[0][1] = record->y - radius;
+        points[1][0] = record->x + radius;
+        points[1][1] = record->y + radius;
+        pointNum = 2;
+    }
+    else {
+        for (uint8_t i = 0; i < 3; i++) {
+            points[i][0] = stream->vtxBuf.vertices[primitive->vertex + i].x;
+            points[i][1] = stream->vtxBuf.vertices[primitive->vertex + i].y;
+        }
+    }
+    float bounds[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+    for (uint8_t i = 0; i < pointNum; i++) {
+        float x = (viewProj[0] * points[i][0] + viewProj[4] * points[i][1] + viewProj[12]) * 0.5f + 0.5f;
+        float y = (viewProj[1] * points[i][0] + viewProj[5] * points[i][1] + viewProj[13]) * 0.5f + 0.5f;
+        bounds[0] = fminf(bounds[0], x * width);
+        bounds[1] = fminf(bounds[1], y * height);
+        bounds[2] = fmaxf(bounds[2], x * width);
+        bounds[3] = fmaxf(bounds[3], y * height);
+    }
+    // A pixel more on every side for filtering and rounding
+    int32_t rect[4] = { (int32_t)fmaxf(floorf(bounds[0]) - 1.0f, 0.0f), (int32_t)fmaxf(floorf(bounds[1]) - 1.0f, 0.0f),
+                        (int32_t)fminf(ceilf(bounds[2]) + 1.0f, width), (int32_t)fminf(ceilf(bounds[3]) + 1.0f, height) };
+    if (rect[0] < rect[2] && rect[1] < rect[3])
+        _O2D_AddDirtyRect(dirty, rect);
+}
+
+void _O2D_AddDirtyRect(O2D_DirtyTracker *dirty, const int32_t rect[4]) {
+    int32_t merged[4] = { rect[0], rect[1], rect[2], rect[3] };
+    for (uint32_t i = 0; i < dirty->rectNum;) {
+        const int32_t *other = dirty->rects[i];
+        if (merged[0] <= other[2] && other[0] <= merged[2] && merged[1] <= other[3] && other[1] <= merged[3]) {
+            // Growing can make it touch the ones already passed, so start over
+            for (uint8_t j = 0; j < 2; j++) {
+                merged[j] = other[j] < merged[j] ? other[j] : merged[j];
+                merged[j + 2] = other[j + 2] > merged[j + 2] ? other[j + 2] : merged[j + 2];
+            }
+            memcpy(dirty->rects[i], dirty->rects[--dirty->rectNum], sizeof(dirty->rects[i]));
+            i = 0;
+        }
+        else {
+            i++;
+        }
+    }
+    if (dirty->rectNum == O2D_MAX_DIRTY_RECTS) {
+        uint32_t best = 0;
+        int64_t bestGrowth = INT64_MAX;
+        for (uint32_t i = 0; i < dirty->rectNum; i++) {
+            const int32_t *other = dirty->rects[i];
+            int64_t x0 = other[0] < merged[0] ? other[0] : merged[0], y0 = other[1] < merged[1] ? other[1] : merged[1];
+            int64_t x1 = other[2] > merged[2] ? other[2] : merged[2], y1 = other[3] > merged[3] ? other[3] : merged[3];
+            int64_t growth = (x1 - x0) * (y1 - y0) - (int64_t)(other[2] - other[0]) * (other[3] - other[1]);
+            if (growth < bestGrowth) {
+                bestGrowth = growth;
+                best = i;
+            }
+        }
+        const int32_t *other = dirty->rects[best];
+        for (uint8_t j = 0; j < 2; j++) {
+            merged[j] = other[j] < merged[j] ? other[j] : merged[j];
+            merged[j + 2] = other[j + 2] > merged[j + 2] ? other[j + 2] : merged[j + 2];
+        }
+        memcpy(dirty->rects[best], dirty->rects[--dirty->rectNum], sizeof(dirty->rects[best]));
+        _O2D_AddDirtyRect(dirty, merged);
+        return;
+    }
+    memcpy(dirty->rects[dirty->rectNum++], merged, sizeof(merged));
+}
+
+void _O2D_BindDirtyFramebuffer(O2D_Renderer *renderer, uint16_t width, uint16_t height) {
+    O2D_DirtyTracker *dirty = &renderer->dirty;
+    if (dirty->framebuffer == 0 || dirty->width != width || dirty->height != height) {
+        if (dirty->framebuffer != 0) {
+            glDeleteFramebuffers(1, &dirty->framebuffer);
+            glDeleteRenderbuffers(1, &dirty->colorBuffer);
+            glDeleteRenderbuffers(1, &dirty->depthStencilBuffer);
+        }
+        dirty->width = width;
+        dirty->height = height;
+        glCreateRenderbuffers(1, &dirty->colorBuffer);
+        glNamedRenderbufferStorage(dirty->colorBuffer, GL_RGBA8, width, height);
+        glCreateRenderbuffers(1, &dirty->depthStencilBuffer);
+        glNamedRenderbufferStorage(dirty->depthStencilBuffer, GL_DEPTH24_STENCIL8, width, height);
+        glCreateFramebuffers(1, &dirty->framebuffer);
+        glNamedFramebufferRenderbuffer(dirty->framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, dirty->colorBuffer);
+        glNamedFramebufferRenderbuffer(dirty->framebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                                       dirty->depthStencilBuffer);
+        dirty->valid = false;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, dirty->framebuffer);
+}
+
+void _O2D_BlitDirtyFramebuffer(O2D_Renderer *renderer) {
+    O2D_DirtyTracker *dirty = &renderer->dirty;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, dirty->framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, dirty->width, dirty->height, 0, 0, dirty->width, dirty->height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void _O2D_ReleaseDirtyRects(O2D_Renderer *renderer) {
+    O2D_DirtyTracker *dirty = &renderer->dirty;
+    if (dirty->framebuffer != 0) {
+        glDeleteFramebuffers(1, &dirty->framebuffer);
+        glDeleteRenderbuffers(1, &dirty->colorBuffer);
+        glDeleteRenderbuffers(1, &dirty->depthStencilBuffer);
+    }
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        _O2D_Free(dirty->previous[i].vtxBuf.vertices);
+        _O2D_Free(dirty->previous[i].spriteBuf.sprites);
+        _O2D_Free(dirty->previous[i].batches);
+    }
+    O2D_ZeroMem(dirty, sizeof(O2D_DirtyTracker));
+}
+
+void _O2D_CopyStream(O2D_BatchStream *dst, const O2D_BatchStream *src, const O2D_BufferPolicy *policy) {
+    _O2D_EnsureVtxBufSize(policy, &dst->vtxBuf, src->vtxBuf.number);
+    memcpy(dst->vtxBuf.vertices, src->vtxBuf.vertices, src->vtxBuf.number * sizeof(O2D_Vertex));
+    dst->vtxBuf.number = src->vtxBuf.number;
+    _O2D_EnsureSpriteBufSize(policy, &dst->spriteBuf, src->spriteBuf.number);
+    memcpy(dst->spriteBuf.sprites, src->spriteBuf.sprites, src->spriteBuf.number * sizeof(O2D_SpriteRecord));
+    dst->spriteBuf.number = src->spriteBuf.number;
+    if (dst->batchCapacity < src->batchNum) {
+        dst->batchCapacity = src->batchNum;
+        dst->batches = _O2D_Realloc(dst->batches, dst->batchCapacity * sizeof(O2D_Batch));
+    }
+    memcpy(dst->batches, src->batches, src->batchNum * sizeof(O2D_Batch));
+    dst->batchNum = src->batchNum;
+}
+
+void _O2D_InitIndirectSubmit(O2D_Renderer *renderer) {
+    _O2D_glGetTextureHandleARB =
+        (O2D_PFNGLGETTEXTUREHANDLEARBPROC)glfwGetProcAddress("glGetTextureHandleARB");
+    _O2D_glMakeTextureHandleResidentARB =
+        (O2D_PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)glfwGetProcAddress("glMakeTextureHandleResidentARB");
+    renderer->indirect.supported = glfwExtensionSupported("GL_ARB_bindless_texture") &&
+        glfwExtensionSupported("GL_ARB_shader_draw_parameters") &&
+        _O2D_glGetTextureHandleARB != NULL && _O2D_glMakeTextureHandleResidentARB != NULL;
+}
+
+void _O2D_ReleaseIndirectSubmit(O2D_Renderer *renderer) {
+    O2D_IndirectSubmit *indirect = &renderer->indirect;
+    if (indirect->commandBuffer != 0) {
+        glDeleteBuffers(1, &indirect->commandBuffer);
+        glDeleteBuffers(1, &indirect->drawParamBuffer);
+        glDeleteBuffers(1, &indirect->textureTableBuffer);
+    }
+    _O2D_Free(indirect->textureHandles);
+    _O2D_Free(indirect->commands);
+    _O2D_Free(indirect->drawParams);
+    _O2D_Free(indirect->textureTable);
+    _O2D_Free(indirect->batches);
+    O2D_ZeroMem(indirect, sizeof(O2D_IndirectSubmit));
+}
+
+uint64_t _O2D_GetTextureHandle(O2D_Renderer *renderer, uint32_t texture) {
+    O2D_IndirectSubmit *indirect = &renderer->indirect;
+    if (texture >= indirect->textureHandleCapacity) {
+        uint32_t capacity = indirect->textureHandleCapacity ? indirect->textureHandleCapacity : 64;
+        while (capacity <= texture)
+            capacity *= 2;
+        indirect->textureHandles = _O2D_Realloc(indirect->textureHandles, capacity * sizeof(uint64_t));
+        O2D_ZeroMem(indirect->textureHandles + indirect->textureHandleCapacity,
+                    (capacity - indirect->textureHandleCapacity) * sizeof(uint64_t));
+        indirect->textureHandleCapacity = capacity;
+    }
+    // The handle freezes the texture's sampling parameters, which O2D never changes after creation
+    if (indirect->textureHandles[texture] == 0) {
+        indirect->textureHandles[texture] = _O2D_glGetTextureHandleARB(texture);
+        _O2D_glMakeTextureHandleResidentARB(indirect->textureHandles[texture]);
+    }
+    return indirect->textureHandles[texture];
+}
+
+void _O2D_UpdateStreaming(O2D_Renderer *renderer) {
+    bool streaming = renderer->submitMode == O2D_SUBMIT_STREAMING && renderer->renderThread == NULL &&
+                     !renderer->depthSorting && !renderer->dirtyRects;
+    renderer->sealVertexNum = streaming ? O2D_STREAM_CHUNK_SIZE / sizeof(O2D_Vertex) / 6 * 6 : UINT32_MAX;
+}
+
+void _O2D_MakeChunkRoom(O2D_Renderer *renderer, O2D_BatchStream *stream, uint32_t vertexNum, uint32_t spriteNum) {
+    if (renderer->sealVertexNum == UINT32_MAX || stream != &renderer->streams[O2D_PASS_ORDERED])
+        return;
+    if (stream->vtxBuf.number + vertexNum > renderer->sealVertexNum ||
+        stream->spriteBuf.number + spriteNum > O2D_STREAM_CHUNK_SIZE / sizeof(O2D_SpriteRecord))
+        _O2D_SealChunk(renderer);
+}
+
+void _O2D_SealChunk(O2D_Renderer *renderer) {
+    O2D_BatchStream *stream = &renderer->streams[O2D_PASS_ORDERED];
+    _O2D_CloseStreamBatch(renderer, stream);
+    if (stream->batchNum == 0)
+        return;
+    O2D_ZONE_BEGIN("_O2D_SealChunk");
+    O2D_StreamRing *ring = &renderer->streamRing;
+    if (ring->buffer == 0)
+        _O2D_InitStreamRing(renderer);
+    _O2D_ComputeViewProjMatrix(renderer);
+    uint32_t vertexSize = stream->vtxBuf.number * sizeof(O2D_Vertex);
+    uint32_t spriteSize = stream->spriteBuf.number * sizeof(O2D_SpriteRecord);
+    int32_t chunks[2] = { -1, -1 };
+    if (vertexSize > 0) {
+        chunks[0] = _O2D_WriteStreamChunk(renderer, stream->vtxBuf.vertices, vertexSize);
+        glVertexArrayVertexBuffer(ring->VAO, 0, ring->buffer, chunks[0] * O2D_STREAM_CHUNK_SIZE, sizeof(O2D_Vertex));
+    }
+    if (spriteSize > 0) {
+        chunks[1] = _O2D_WriteStreamChunk(renderer, stream->spriteBuf.sprites, spriteSize);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, ring->buffer, chunks[1] * O2D_STREAM_CHUNK_SIZE, spriteSize);
+    }
+    for (uint32_t i = 0; i < stream->batchNum; i++) {
+        const O2D_Batch *batch = &stream->batches[i];
+        bool sprites = batch->state.vertexFormat == O2D_VERTEX_FORMAT_SPRITE;
+        _O2D_BindVertexArray(renderer, sprites ? renderer->spriteVAO : ring->VAO);
+        _O2D_ApplyRenderState(renderer, &batch->state, renderer->viewProjMatrix);
+        for (uint16_t k = 0; k < batch->usedSlots; k++)
+            _O2D_BindTextureUnit(renderer, k, batch->textures[k]);
+        _O2D_DrawTimed(renderer, batch->firstVertex, batch->vertexNum);
+    }
+    for (uint8_t i = 0; i < 2; i++) {
+        if (chunks[i] >= 0)
+            ring->fences[chunks[i]] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    // Lets the GPU start on this chunk while the next one is recorded
+    glFlush();
+    renderer->stats.uploadedBytes += vertexSize + spriteSize;
+    _O2D_TrimStream(renderer, stream);
+    _O2D_ResetStream(stream);
+    O2D_ZONE_END("_O2D_SealChunk");
+}
+
+uint32_t _O2D_WriteStreamChunk(O2D_Renderer *renderer, const void *data, uint32_t size) {
+    O2D_StreamRing *ring = &renderer->streamRing;
+    uint32_t chunk = ring->nextChunk;
+    ring->nextChunk = (chunk + 1) % O2D_STREAM_CHUNK_NUM;
+    // Only waits when the GPU is a whole ring behind
+    if (ring->fences[chunk] != NULL) {
+        O2D_ZONE_BEGIN("_O2D_WriteStreamChunk wait");
+        GLenum result;
+        do
+            result = glClientWaitSync(ring->fences[chunk], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        while (result == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(ring->fences[chunk]);
+        ring->fences[chunk] = NULL;
+        O2D_ZONE_END("_O2D_WriteStreamChunk wait");
+    }
+    GLintptr offset = (GLintptr)chunk * O2D_STREAM_CHUNK_SIZE;
+    void *memory = glMapNamedBufferRange(ring->buffer, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+                                         GL_MAP_INVALIDATE_RANGE_BIT);
+    if (memory != NULL) {
+        memcpy(memory, data, size);
+        glUnmapNamedBuffer(ring->buffer);
+    }
+    else {
+        glNamedBufferSubData(ring->buffer, offset, size, data);
+    }
+    return chunk;
+}
+
+void _O2D_InitStreamRing(O2D_Renderer *renderer) {
+    O2D_StreamRing *ring = &renderer->streamRing;
+    glCreateBuffers(1, &ring->buffer);
+    glNamedBufferData(ring->buffer, O2D_STREAM_CHUNK_NUM * O2D_STREAM_CHUNK_SIZE, NULL, GL_STREAM_DRAW);
+    // The layout of VAO, with the buffer bound per chunk instead
+    glCreateVertexArrays(1, &ring->VAO);
+    const uint32_t offsets[4] = { offsetof(O2D_Vertex, x), offsetof(O2D_Vertex, u),
+                                  offsetof(O2D_Vertex, textureSlot), offsetof(O2D_Vertex, z) };
+    const int32_t sizes[4] = { 2, 2, 1, 1 };
+    for (uint32_t i = 0; i < 4; i++) {
+        glEnableVertexArrayAttrib(ring->VAO, i);
+        glVertexArrayAttribFormat(ring->VAO, i, sizes[i], GL_FLOAT, GL_FALSE, offsets[i]);
+        glVertexArrayAttribBinding(ring->VAO, i, 0);
+    }
+    glEnableVertexArrayAttrib(ring->VAO, 4);
+    glVertexArrayAttribFormat(ring->VAO, 4, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(O2D_Vertex, color));
+    glVertexArrayAttribBinding(ring->VAO, 4, 0);
+}
+
+void _O2D_ReleaseStreamRing(O2D_Renderer *renderer) {
+    O2D_StreamRing *ring = &renderer->streamRing;
+    if (ring->buffer == 0)
+        return;
+    for (uint32_t i = 0; i < O2D_STREAM_CHUNK_NUM; i++) {
+        if (ring->fences[i] != NULL)
+            glDeleteSync(ring->fences[i]);
+    }
+    glDeleteBuffers(1, &ring->buffer);
+    glDeleteVertexArrays(1, &ring->VAO);
+    O2D_ZeroMem(ring, sizeof(O2D_StreamRing));
+}
+
+void _O2D_QueueFrame(O2D_Renderer *renderer) {
+    O2D_RenderThread *thread = renderer->renderThread;
+    _O2D_FinishStreams(renderer);
+    _O2D_ComputeViewProjMatrix(renderer);
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        renderer->stats.uploadedBytes += renderer->streams[i].vtxBuf.number * sizeof(O2D_Vertex) +
+                                         renderer->streams[i].spriteBuf.number * sizeof(O2D_SpriteRecord);
+    }
+
+    O2D_ZONE_BEGIN("_O2D_QueueFrame wait");
+    pthread_mutex_lock(&thread->mutex);
+    while (thread->submitted)
+        pthread_cond_wait(&thread->cond, &thread->mutex);
+    O2D_ZONE_END("_O2D_QueueFrame wait");
+    // The render thread is idle: hand it the recorded frame and record the next one
+    // into the streams it just finished with
+    for (uint8_t i = 0; i < O2D_PASS_NUM; i++) {
+        O2D_BatchStream stream = thread->streams[i];
+        thread->streams[i] = renderer->streams[i];
+        renderer->streams[i] = stream;
+        _O2D_TrimStream(renderer, &renderer->streams[i]);
+        _O2D_ResetStream(&renderer->streams[i]);
+    }
+
+    memcpy(thread->viewProjMatrix, renderer->viewProjMatrix, sizeof(thread->viewProjMatrix));
+    memcpy(thread->clearColor, renderer->clearColor, sizeof(thread->clearColor));
+    thread->frameIndex = renderer->frameIndex;
+    thread->swapInterval = renderer->swapInterval;
+    thread->submitMode = renderer->submitMode;
+    thread->bufferPolicy = renderer->bufferPolicy;
+    thread->dirtyRects = renderer->dirtyRects;
+    thread->depthSorting = renderer->depthSorting;
+    thread->gpuTiming = renderer->gpuTiming;
+    thread->overdrawProfiling = renderer->overdrawProfiling;
+    thread->framebufferWidth = renderer->framebufferWidth;
+    thread->framebufferHeight = renderer->framebufferHeight;
+    if (thread->frameLimiter.targetTime != renderer->frameLimiter.targetTime) {
+        thread->frameLimiter.targetTime = renderer->frameLimiter.targetTime;
+        thread->frameLimiter.deadline = 0;
+    }
+    _O2D_CopyGpuResults(renderer, &renderer->stats);
+    renderer->overdrawReport = renderer->overdraw.result;
+    renderer->stats.allocationNum += thread->allocationNum;
+    renderer->stats.elidedBytes += thread->elidedBytes;
+    if (thread->dirtyRects)
+        renderer->stats.redrawnPixels += renderer->dirty.redrawnPixels;
+    thread->submitted = true;
+    pthread_cond_broadcast(&thread->cond);
+    pthread_mutex_unlock(&thread->mutex);
+}
+
+void _O2D_RecordFlightFrame(O2D_Renderer *renderer) {
+    O2D_FlightRecorder *recorder = &renderer->flightRecorder;
+    if (recorder->frames == NULL)
+        return;
+    recorder->frames[recorder->head] = renderer->lastStats;
+    recorder->head = (recorder->head + 1) % O2D_FLIGHT_RECORDER_FRAMES;
+    if (recorder->frameNum < O2D_FLIGHT_RECORDER_FRAMES)
+        recorder->frameNum++;
+    if (renderer->lastStats.frameTime > recorder->threshold &&
+        recorder->dumpNum < O2D_FLIGHT_RECORDER_MAX_DUMPS) {
+        _O2D_DumpFlightRecorder(renderer);
+        recorder->dumpNum++;
+        // The next dump only contains frames that come after this one
+        recorder->frameNum = 0;
+        // Writing the file isn't part of the next frame, or it would look like a hitch too
+        renderer->frameEndTime = _O2D_GetTimeNs();
+    }
+}
+
+bool _O2D_DumpFlightRecorder(O2D_Renderer *renderer) {
+    O2D_FlightRecorder *recorder = &renderer->flightRecorder;
+    char path[300];
+    snprintf(path, sizeof(path), "%s_%llu.json", recorder->pathPrefix,
+             (unsigned long long)renderer->lastStats.frameIndex);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Could not open flight recorder file %s.\n", path);
+        return false;
+    }
+    uint32_t first = (recorder->head + O2D_FLIGHT_RECORDER_FRAMES - recorder->frameNum) % O2D_FLIGHT_RECORDER_FRAMES;
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (uint32_t i = 0; i < recorder->frameNum; i++) {
+        O2D_FrameStats *frame = &recorder->frames[(first + i) % O2D_FLIGHT_RECORDER_FRAMES];
+        fprintf(file,
+                "%s{\"name\":\"frame\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{"
+                "\"frameTime\":%.3f,\"cpuTime\":%.3f,\"gpuTime\":%.3f,\"batchNum\":%u,\"vertexNum\":%u}},\n"
+                "{\"name\":\"frame %llu\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":0,"
+                "\"args\":{\"gpuFrameIndex\":%llu,\"uploadedBytes\":%llu,\"elidedBytes\":%llu}}",
+                i == 0 ? "" : ",\n", frame->beginTime / 1e3, frame->frameTime, frame->cpuTime, frame->gpuTime,
+                frame->batchNum, frame->vertexNum, (unsigned long long)frame->frameIndex, frame->beginTime / 1e3,
+                (unsigned long long)frame->gpuFrameIndex, (unsigned long long)frame->uploadedBytes,
+                (unsigned long long)frame->elidedBytes);
+    }
+    uint64_t since = recorder->frameNum > 0 ? recorder->frames[first].beginTime : 0;
+    _O2D_TraceWriteEvents(file, since, recorder->frameNum == 0);
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
+
+void _O2D_CaptureVertices(uint32_t *words, const O2D_Vertex *vertices, uint32_t vertexNum) {
+    for (uint32_t i = 0; i < vertexNum; i++) {
+        words[i * 5] = _O2D_FloatBits(vertices[i].x);
+        words[i * 5 + 1] = _O2D_FloatBits(vertices[i].y);
+        words[i * 5 + 2] = _O2D_FloatBits(vertices[i].u);
+        words[i * 5 + 3] = _O2D_FloatBits(vertices[i].v);
+        words[i * 5 + 4] = vertices[i].color;
+    }
+}
+
+void _O2D_CaptureCall(uint8_t op, const uint32_t *words, uint32_t wordNum) {
+    O2D_Capture *capture = &_O2D_capture;
+    if (capture->length + 1 + wordNum * 5 > O2D_CAPTURE_BUFFER_SIZE)
+        _O2D_FlushCapture();
+    if (op == O2D_CAPTURE_BEGIN)
+        _O2D_NextCaptureFrame(&capture->history);
+    capture->buffer[capture->length++] = op;
+    if (wordNum == 0)
+        return;
+    const uint32_t *base;
+    uint32_t *slot = _O2D_NextCaptureSlot(&capture->history, op, &base);
+    for (uint32_t i = 0; i < wordNum; i++) {
+        uint32_t delta = words[i] ^ base[i];
+        slot[i] = words[i];
+        while (delta >= 0x80) {
+            capture->buffer[capture->length++] = (uint8_t)(delta | 0x80);
+            delta >>= 7;
+        }
+        capture->buffer[capture->length++] = (uint8_t)delta;
+    }
+}
+
+uint32_t *_O2D_NextCaptureSlot(O2D_CaptureHistory *history, uint8_t op, const uint32_t **base) {
+    static const uint32_t zero[O2D_CAPTURE_MAX_WORDS];
+    uint32_t stride = _O2D_captureWordNums[op];
+    uint32_t index = history->callNum[op]++;
+    if (index >= history->capacity[op]) {
+        uint32_t capacity = history->capacity[op] ? history->capacity[op] * 2 : 64;
+        history->calls[op] = _O2D_Realloc(history->calls[op], capacity * stride * sizeof(uint32_t));
+        O2D_ZeroMem(history->calls[op] + history->capacity[op] * stride,
+                    (capacity - history->capacity[op]) * stride * sizeof(uint32_t));
+        history->capacity[op] = capacity;
+    }
+    uint32_t *slot = history->calls[op] + index * stride;
+    if (index < history->lastCallNum[op])
+        *base = slot;
+    else
+        *base = index > 0 ? slot - stride : zero;
+    return slot;
+}
+
+void _O2D_NextCaptureFrame(O2D_CaptureHistory *history) {
+    for (uint8_t op = 0; op < O2D_CAPTURE_OP_NUM; op++) {
+        history->lastCallNum[op] = history->callNum[op];
+        history->callNum[op] = 0;
+    }
+}
+
+void _O2D_ReleaseCaptureHistory(O2D_CaptureHistory *history) {
+    for (uint8_t op = 0; op < O2D_CAPTURE_OP_NUM; op++)
+        _O2D_Free(history->calls[op]);
+    O2D_ZeroMem(history, sizeof(O2D_CaptureHistory));
+}
+
+void _O2D_CaptureTexture(uint32_t texture, const uint8_t *data, int32_t width, int32_t height) {
+    O2D_Capture *capture = &_O2D_capture;
+    if (texture >= capture->textureCapacity) {
+        uint32_t capacity = capture->textureCapacity ? capture->textureCapacity : 64;
+        while (capacity <= texture)
+            capacity *= 2;
+        capture->textures = _O2D_Realloc(capture->textures, capacity * sizeof(bool));
+        O2D_ZeroMem(capture->textures + capture->textureCapacity, (capacity - capture->textureCapacity) * sizeof(bool));
+        capture->textureCapacity = capacity;
+    }
+    capture->textures[texture] = true;
+    uint32_t words[4] = { texture, width, height, data != NULL };
+    _O2D_CaptureCall(O2D_CAPTURE_TEXTURE, words, 4);
+    if (data != NULL) {
+        // Pixels are written as they are, straight from the caller's memory
+        size_t size = (size_t)width * height * 4;
+        _O2D_FlushCapture();
+        if (fwrite(data, 1, size, _O2D_captureFile) != size)
+            capture->failed = true;
+    }
+}
+
+void _O2D_CaptureTextureUse(uint32_t texture) {
+    O2D_Capture *capture = &_O2D_capture;
+    if (texture == 0 || (texture < capture->textureCapacity && capture->textures[texture]))
+        return;
+    // Created before the capture started, its pixels only exist on the GPU by now
+    int32_t width = 0, height = 0;
+    glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_HEIGHT, &height);
+    if (width <= 0 || height <= 0) {
+        _O2D_CaptureTexture(texture, NULL, 1, 1);
+        return;
+    }
+    uint8_t *pixels = _O2D_Malloc((size_t)width * height * 4);
+    glGetTextureImage(texture, 0, GL_RGBA, GL_UNSIGNED_BYTE, width * height * 4, pixels);
+    _O2D_CaptureTexture(texture, pixels, width, height);
+    _O2D_Free(pixels);
+}
+
+bool _O2D_FlushCapture(void) {
+    O2D_Capture *capture = &_O2D_capture;
+    if (capture->length > 0 && fwrite(capture->buffer, 1, capture->length, _O2D_captureFile) != capture->length)
+        capture->failed = true;
+    capture->length = 0;
+    return !capture->failed;
+}
+
+bool _O2D_ReadCaptureCall(O2D_CaptureReader *reader, uint8_t op, uint32_t *words) {
+    if (op == O2D_CAPTURE_BEGIN)
+        _O2D_NextCaptureFrame(&reader->history);
+    uint32_t wordNum = _O2D_captureWordNums[op];
+    if (wordNum == 0)
+        return true;
+    const uint32_t *base;
+    uint32_t *slot = _O2D_NextCaptureSlot(&reader->history, op, &base);
+    for (uint32_t i = 0; i < wordNum; i++) {
+        uint32_t delta = 0;
+        for (uint32_t shift = 0;; shift += 7) {
+            if (reader->offset >= reader->size || shift > 28)
+                return false;
+            uint8_t byte = reader->data[reader->offset++];
+            delta |= (uint32_t)(byte & 0x7F) << shift;
+            if (byte < 0x80)
+                break;
+        }
+        words[i] = slot[i] = delta ^ base[i];
+        // A mesh only has the points its first field counts
+        if (op == O2D_CAPTURE_SPRITE_MESH && i == 0) {
+            if (words[0] > O2D_MAX_MESH_POINTS)
+                return false;
+            wordNum = 22 + words[0] * 2;
+        }
+    }
+    return true;
+}
+
+bool _O2D_ReplayCall(O2D_Renderer *renderer, O2D_CaptureReader *reader, uint32_t **textureMap,
+                     uint32_t *textureMapCapacity, O2D_ReplayStats *stats) {
+    uint8_t op = reader->data[reader->offset++];
+    uint32_t words[O2D_CAPTURE_MAX_WORDS];
+    if (op >= O2D_CAPTURE_OP_NUM || !_O2D_ReadCaptureCall(reader, op, words))
+        return false;
+    stats->callNum++;
+    // Textures are always recorded before their first use
+    uint32_t texture = 0;
+    O2D_Quad quad;
+    if (op == O2D_CAPTURE_QUAD || op == O2D_CAPTURE_SPRITE || op == O2D_CAPTURE_SPRITE_MESH ||
+        op == O2D_CAPTURE_TRIANGLE) {
+        uint32_t recorded = words[op == O2D_CAPTURE_SPRITE_MESH ? 1 : 0];
+        texture = recorded < *textureMapCapacity ? (*textureMap)[recorded] : 0;
+    }
+    if (op == O2D_CAPTURE_QUAD || op == O2D_CAPTURE_SPRITE_MESH || op == O2D_CAPTURE_TRIANGLE) {
+        const uint32_t *quadWords = words + (op == O2D_CAPTURE_SPRITE_MESH ? 2 : 1);
+        for (uint8_t i = 0; i < (op == O2D_CAPTURE_TRIANGLE ? 3 : 4); i++) {
+            quad[i] = (O2D_Vertex){ _O2D_BitsFloat(quadWords[i * 5]), _O2D_BitsFloat(quadWords[i * 5 + 1]),
+                                    _O2D_BitsFloat(quadWords[i * 5 + 2]), _O2D_BitsFloat(quadWords[i * 5 + 3]),
+                                    .color = quadWords[i * 5 + 4] };
+        }
+    }
+    switch (op) {
+    case O2D_CAPTURE_BEGIN:
+        O2D_Begin(renderer);
+        break;
+    case O2D_CAPTURE_END:
+        O2D_End(renderer);
+        stats->frameNum++;
+        break;
+    case O2D_CAPTURE_RENDER_BATCH:
+        O2D_RenderBatch(renderer);
+        break;
+    case O2D_CAPTURE_CLEAR_BATCH:
+        O2D_ClearBatch(renderer);
+        break;
+    case O2D_CAPTURE_QUAD:
+        O2D_PushQuad(renderer, quad, texture);
+        break;
+    case O2D_CAPTURE_TRIANGLE:
+        O2D_PushTriangle(renderer, quad, texture);
+        break;
+    case O2D_CAPTURE_SPRITE: {
+        O2D_Sprite sprite = { .x = _O2D_BitsFloat(words[1]), .y = _O2D_BitsFloat(words[2]),
+                              .width = _O2D_BitsFloat(words[3]), .height = _O2D_BitsFloat(words[4]),
+                              .angle = _O2D_BitsFloat(words[5]) };
+        for (uint8_t i = 0; i < 4; i++) {
+            sprite.uvRect[i] = _O2D_BitsFloat(words[6 + i]);
+            sprite.color[i] = _O2D_BitsFloat(words[10 + i]);
+        }
+        O2D_PushSprite(renderer, &sprite, texture);
+        break;
+    }
+    case O2D_CAPTURE_SPRITE_MESH: {
+        O2D_SpriteMesh mesh;
+        mesh.pointNum = words[0];
+        for (uint8_t i = 0; i < mesh.pointNum; i++) {
+            mesh.points[i][0] = _O2D_BitsFloat(words[22 + i * 2]);
+            mesh.points[i][1] = _O2D_BitsFloat(words[23 + i * 2]);
+        }
+        O2D_PushSpriteMesh(renderer, &mesh, quad, texture);
+        break;
+    }
+    case O2D_CAPTURE_TEXTURE: {
+        uint32_t recorded = words[0];
+        size_t size = words[3] ? (size_t)words[1] * words[2] * 4 : 0;
+        if (reader->size - reader->offset < size)
+            return false;
+        if (recorded >= *textureMapCapacity) {
+            uint32_t capacity = *textureMapCapacity ? *textureMapCapacity : 64;
+            while (capacity <= recorded)
+                capacity *= 2;
+            *textureMap = _O2D_Realloc(*textureMap, capacity * sizeof(uint32_t));
+            O2D_ZeroMem(*textureMap + *textureMapCapacity, (capacity - *textureMapCapacity) * sizeof(uint32_t));
+            *textureMapCapacity = capacity;
+        }
+        // Repeated replays draw with the textures the first one created
+        if ((*textureMap)[recorded] == 0) {
+            uint8_t *pixels = size > 0 ? (uint8_t *)reader->data + reader->offset : NULL;
+            (*textureMap)[recorded] = O2D_CreateTexture(pixels, words[1], words[2]);
+        }
+        reader->offset += size;
+        break;
+    }
+    case O2D_CAPTURE_CAMERA:
+        O2D_SetCamera(renderer, _O2D_BitsFloat(words[0]), _O2D_BitsFloat(words[1]));
+        break;
+    case O2D_CAPTURE_TINT:
+        O2D_SetTint(renderer, _O2D_BitsFloat(words[0]), _O2D_BitsFloat(words[1]),
+                    _O2D_BitsFloat(words[2]), _O2D_BitsFloat(words[3]));
+        break;
+    case O2D_CAPTURE_ALPHA_TEST:
+        O2D_SetAlphaTest(renderer, _O2D_BitsFloat(words[0]));
+        break;
+    case O2D_CAPTURE_BLENDING:
+        O2D_SetBlending(renderer, words[0] != 0);
+        break;
+    case O2D_CAPTURE_CLEAR_COLOR:
+        O2D_SetClearColor(renderer, _O2D_BitsFloat(words[0]), _O2D_BitsFloat(words[1]),
+                          _O2D_BitsFloat(words[2]), _O2D_BitsFloat(words[3]));
+        break;
+    case O2D_CAPTURE_DEPTH_SORTING:
+        O2D_SetDepthSorting(renderer, words[0] != 0);
+        break;
+    case O2D_CAPTURE_SUBMIT_MODE:
+        // Falls back to the current mode on drivers without multi-draw indirect
+        O2D_SetSubmitMode(renderer, words[0]);
+        break;
+    }
+    return true;
+}
+
+void *_O2D_Malloc(size_t size) {
+    _O2D_threadAllocationNum++;
+    if (_O2D_allocator.reallocate != NULL)
+        return _O2D_allocator.reallocate(_O2D_allocator.user, NULL, size ? size : 1);
+    return malloc(size);
+}
+
+void *_O2D_Calloc(size_t number, size_t size) {
+    void *memory = _O2D_Malloc(number * size);
+    if (memory != NULL)
+        O2D_ZeroMem(memory, number * size);
+    return memory;
+}
+
+void *_O2D_Realloc(void *ptr, size_t size) {
+    _O2D_threadAllocationNum++;
+    if (_O2D_allocator.reallocate != NULL)
+        return _O2D_allocator.reallocate(_O2D_allocator.user, ptr, size ? size : 1);
+    return realloc(ptr, size);
+}
+
+void _O2D_Free(void *ptr) {
+    if (ptr == NULL)
+        return;
+    if (_O2D_allocator.release != NULL)
+        _O2D_allocator.release(_O2D_allocator.user, ptr);
+    else
+        free(ptr);
+}
+
+void _O2D_ResetFrameArena(O2D_FrameArena *arena) {
+    if (arena->overflowNum > 0) {
+        for (uint32_t i = 0; i < arena->overflowNum; i++)
+            _O2D_Free(arena->overflow[i]);
+        _O2D_Free(arena->memory);
+        arena->capacity = arena->requested;
+        arena->memory = _O2D_Malloc(arena->capacity);
+        arena->overflowNum = 0;
+    }
+    arena->used = 0;
+    arena->requested = 0;
+}
+
+void _O2D_ReleaseFrameArena(O2D_FrameArena *arena) {
+    for (uint32_t i = 0; i < arena->overflowNum; i++)
+        _O2D_Free(arena->overflow[i]);
+    _O2D_Free(arena->overflow);
+    _O2D_Free(arena->memory);
+    O2D_ZeroMem(arena, sizeof(O2D_FrameArena));
+}
+
+uint32_t _O2D_FloatBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float _O2D_BitsFloat(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint32_t _O2D_GrowCapacity(const O2D_BufferPolicy *policy, uint32_t required, uint32_t capacity) {
+    if (required <= capacity)
+        return capacity;
+    double grown = (double)required * policy->growth;
+    uint32_t limit = policy->maxVertices > 0 ? policy->maxVertices : UINT32_MAX;
+    if (grown > limit)
+        return required > limit ? required : limit;
+    return grown < O2D_MIN_VTX_NUM ? O2D_MIN_VTX_NUM : (uint32_t)grown;
+}
+
+uint32_t _O2D_DecayCapacity(const O2D_BufferPolicy *policy, O2D_BufferUsage *usage, uint32_t used, uint32_t capacity) {
+    if (policy->decayFrames == 0 || capacity <= O2D_MIN_VTX_NUM || used > capacity / 2) {
+        *usage = (O2D_BufferUsage){ 0 };
+        return capacity;
+    }
+    usage->quietPeak = used > usage->quietPeak ? used : usage->quietPeak;
+    if (++usage->quietFrames < policy->decayFrames)
+        return capacity;
+    double target = (double)usage->quietPeak * policy->growth;
+    *usage = (O2D_BufferUsage){ 0 };
+    // A large growth factor can put the target above the capacity, which is no reason to reallocate
+    if (target >= capacity)
+        return capacity;
+    return target < O2D_MIN_VTX_NUM ? O2D_MIN_VTX_NUM : (uint32_t)target;
+}
+
+void _O2D_TrimStream(O2D_Renderer *renderer, O2D_BatchStream *stream) {
+    // No cap here: the whole frame has to be recorded before it is submitted
+    O2D_BufferPolicy policy = renderer->bufferPolicy;
+    policy.maxVertices = 0;
+    O2D_VertexBuffer *vtxBuf = &stream->vtxBuf;
+    uint32_t capacity = _O2D_DecayCapacity(&policy, &vtxBuf->usage, vtxBuf->number, vtxBuf->capacity);
+    if (capacity != vtxBuf->capacity) {
+        vtxBuf->capacity = capacity;
+        vtxBuf->vertices = _O2D_Realloc(vtxBuf->vertices, capacity * sizeof(O2D_Vertex));
+    }
+    O2D_SpriteBuffer *spriteBuf = &stream->spriteBuf;
+    capacity = _O2D_DecayCapacity(&policy, &spriteBuf->usage, spriteBuf->number, spriteBuf->capacity);
+    if (capacity != spriteBuf->capacity) {
+        spriteBuf->capacity = capacity;
+        spriteBuf->sprites = _O2D_Realloc(spriteBuf->sprites, capacity * sizeof(O2D_SpriteRecord));
+    }
+}
+
+void _O2D_EnsureVtxBufSize(const O2D_BufferPolicy *policy, O2D_VertexBuffer *vtxBuf, uint32_t requiredCapacity) {
+    if (vtxBuf->capacity < requiredCapacity) {
+        // No cap, as in _O2D_TrimStream
+        O2D_BufferPolicy uncapped = *policy;
+        uncapped.maxVertices = 0;
+        vtxBuf->capacity = _O2D_GrowCapacity(&uncapped, requiredCapacity, vtxBuf->capacity);
+        vtxBuf->vertices = _O2D_Realloc(vtxBuf->vertices, vtxBuf->capacity * sizeof(O2D_Vertex));
+    }
+}
+
+void _O2D_EnsureSpriteBufSize(const O2D_BufferPolicy *policy, O2D_SpriteBuffer *spriteBuf, uint32_t requiredCapacity) {
+    if (spriteBuf->capacity < requiredCapacity) {
+        O2D_BufferPolicy uncapped = *policy;
+        uncapped.maxVertices = 0;
+        spriteBuf->capacity = _O2D_GrowCapacity(&uncapped, requiredCapacity, spriteBuf->capacity);
+        spriteBuf->sprites = _O2D_Realloc(spriteBuf->sprites, spriteBuf->capacity * sizeof(O2D_SpriteRecord));
+    }
+}
+
+bool _O2D_TextureIsOpaque(uint32_t texture) {
+    return texture == O2D_NO_TEXTURE || (texture < _O2D_opaqueTextureCapacity && _O2D_opaqueTextures[texture]);
+}
+
+float _O2D_VertexAlpha(const O2D_Vertex *vertices, uint32_t vertexNum) {
+    uint32_t alpha = 255;
+    for (uint32_t i = 0; i < vertexNum; i++) {
+        if (vertices[i].color >> 24 < alpha)
+            alpha = vertices[i].color >> 24;
+    }
+    return alpha / 255.0f;
+}
+
+uint32_t _O2D_MultiplyColor(uint32_t a, uint32_t b) {
+    uint32_t color = 0;
+    for (uint8_t i = 0; i < 32; i += 8) {
+        uint32_t product = (a >> i & 0xFF) * (b >> i & 0xFF);
+        color |= ((product + 127) / 255) << i;
+    }
+    return color;
+}
+
+void _O2D_CreateShaders(O2D_Renderer* renderer) {
+    O2D_ShaderFeatures features = { renderer->streams[O2D_PASS_ORDERED].textureSlots.slotNum, O2D_VERTEX_FORMAT_BATCH, 0 };
+    // The default variant comes first so it is the fallback
+    _O2D_GetShaderVariant(renderer, features, false);
+    // With parallel compilation the other combinations compile while it is waited for. Otherwise
+    // every compile blocks, so each one waits for its first use
+    for (uint8_t format = O2D_VERTEX_FORMAT_BATCH; renderer->programCache.parallelCompile &&
+         format <= O2D_VERTEX_FORMAT_SPRITE; format++) {
+        features.vertexFormat = format;
+        for (uint8_t flags = 0; flags <= (O2D_SHADER_TINT | O2D_SHADER_ALPHA_TEST); flags++) {
+            features.flags = flags;
+            _O2D_GetShaderVariant(renderer, features, false);
+        }
+    }
+    renderer->shader = _O2D_GetShaderVariant(renderer, renderer->shaderVariants[0].features, true)->program;
+}
+
+void _O2D_GenerateShaderSources(const O2D_ShaderFeatures *features, char *vertexSource,
+                                char *fragmentSource, size_t size) {
+    bool bindless = features->flags & O2D_SHADER_BINDLESS;
+    size_t length = 0;
+    length += snprintf(vertexSource + length, size - length, "#version 450 core\n");
+    if (bindless) {
+        // The draw's index in the frame rides in baseInstance, so it stays valid when the
+        // frame is split into several multi-draws
+        length += snprintf(vertexSource + length, size - length,
+            "#extension GL_ARB_shader_draw_parameters : require\n"
+            "flat out uint oDraw;\n");
+    }
+    if (features->vertexFormat == O2D_VERTEX_FORMAT_SPRITE) {
+        // No attributes, every 6 vertices read one record and pick their corner
+        length += snprintf(vertexSource + length, size - length,
+            "struct SpriteRecord { float x, y, width, height, angle; uint uv01, uv23, color, textureSlot; float depth; };\n"
+            "layout (std430, binding = 2) readonly buffer SpriteBuffer { SpriteRecord uSprites[]; };\n"
+            "const vec2 cCorners[6] = vec2[6](vec2(-0.5, -0.5), vec2(-0.5, 0.5), vec2(0.5, 0.5),\n"
+            "                                 vec2(-0.5, -0.5), vec2(0.5, 0.5), vec2(0.5, -0.5));\n");
+    }
+    else {
+        length += snprintf(vertexSource + length, size - length,
+            "layout (location = 0) in vec2 aPos;\n"
+            "layout (location = 1) in vec2 aTexCoord;\n"
+            "layout (location = 2) in float aTexSlot;\n"
+            "layout (location = 3) in float aDepth;\n"
+            "layout (location = 4) in vec4 aColor;\n");
+    }
+    length += snprintf(vertexSource + length, size - length,
+        "out vec2 oTexCoord;\n"
+        "flat out uint oTexSlot;\n"
+        "out vec4 oColor;\n"
+        "uniform mat4 uViewProj;\n"
+        "void main() {\n");
+    if (features->vertexFormat == O2D_VERTEX_FORMAT_SPRITE) {
+        length += snprintf(vertexSource + length, size - length,
+            "SpriteRecord sprite = uSprites[gl_VertexID / 6];\n"
+            "vec2 corner = cCorners[gl_VertexID %% 6];\n"
+            "vec4 uvRect = vec4(unpackUnorm2x16(sprite.uv01), unpackUnorm2x16(sprite.uv23));\n"
+            "oTexCoord = mix(uvRect.xy, uvRect.zw, vec2(corner.x + 0.5, 0.5 - corner.y));\n"
+            "oTexSlot = sprite.textureSlot;\n"
+            "oColor = unpackUnorm4x8(sprite.color);\n"
+            "vec2 offset = corner * vec2(sprite.width, sprite.height);\n"
+            "float s = sin(sprite.angle), c = cos(sprite.angle);\n"
+            "vec2 pos = vec2(sprite.x, sprite.y) + vec2(offset.x * c - offset.y * s, offset.x * s + offset.y * c);\n"
+            "float depth = sprite.depth;\n");
+    }
+    else {
+        length += snprintf(vertexSource + length, size - length,
+            "oTexCoord = aTexCoord;\n"
+            "oTexSlot = uint(aTexSlot);\n"
+            "oColor = aColor;\n"
+            "vec2 pos = aPos;\n"
+            "float depth = aDepth;\n");
+    }
+    if (bindless)
+        length += snprintf(vertexSource + length, size - length, "oDraw = uint(gl_BaseInstanceARB);\n");
+    snprintf(vertexSource + length, size - length,
+            "gl_Position = uViewProj * vec4(pos, depth, 1.0);\n"
+        "}\n");
+
+    length = 0;
+    length += snprintf(fragmentSource + length, size - length, "#version 450 core\n");
+    if (bindless) {
+        // The texture handle isn't dynamically uniform within a draw, which the bindless
+        // drivers O2D targets accept
+        length += snprintf(fragmentSource + length, size - length,
+            "#extension GL_ARB_bindless_texture : require\n"
+            "struct DrawParams { vec4 tint; float alphaThreshold; uint firstTexture; uint textureNum; };\n"
+            "layout (std430, binding = 0) readonly buffer DrawParamBuffer { DrawParams uDrawParams[]; };\n"
+            "layout (std430, binding = 1) readonly buffer TextureTable { uvec2 uTextureHandles[]; };\n"
+            "flat in uint oDraw;\n");
+    }
+    length += snprintf(fragmentSource + length, size - length,
+        "out vec4 FragColor;\n"
+        "in vec2 oTexCoord;\n"
+        "flat in uint oTexSlot;\n"
+        "in vec4 oColor;\n");
+    // Counted before any discard, every shaded fragment costs fill rate. The image store keeps
+    // the driver from rejecting fragments by depth early, so occluded ones are counted too
+    const char *countFragment = "";
+    if (features->flags & O2D_SHADER_OVERDRAW) {
+        length += snprintf(fragmentSource + length, size - length,
+            "layout (binding = 0, r32ui) uniform coherent uimage2D uOverdraw;\n");
+        countFragment = "imageAtomicAdd(uOverdraw, ivec2(gl_FragCoord.xy), 1u);\n";
+    }
+    if (bindless) {
+        length += snprintf(fragmentSource + length, size - length,
+            "void main() {\n"
+                "%s"
+                "DrawParams params = uDrawParams[oDraw];\n"
+                "vec4 color = vec4(1.0);\n"
+                "if (oTexSlot < params.textureNum)\n"
+                    "color = texture(sampler2D(uTextureHandles[params.firstTexture + oTexSlot]), oTexCoord);\n"
+                "color *= oColor * params.tint;\n"
+                "if (color.a < params.alphaThreshold) discard;\n"
+                "FragColor = color;\n"
+            "}\n", countFragment);
+        return;
+    }
+    length += snprintf(fragmentSource + length, size - length,
+        "uniform sampler2D uTextures[%u];\n", features->slotNum);
+    if (features->flags & O2D_SHADER_TINT)
+        length += snprintf(fragmentSource + length, size - length, "uniform vec4 uTint;\n");
+    if (features->flags & O2D_SHADER_ALPHA_TEST)
+        length += snprintf(fragmentSource + length, size - length, "uniform float uAlphaThreshold;\n");
+    // Indexing the sampler array with a varying isn't allowed, a switch is
+    length += snprintf(fragmentSource + length, size - length,
+        "void main() {\n"
+            "%s"
+            "vec4 color;\n"
+            "switch (oTexSlot) {\n", countFragment);
+    for (uint8_t i = 0; i < features->slotNum; i++) {
+        length += snprintf(fragmentSource + length, size - length,
+            "case %uu: color = texture(uTextures[%u], oTexCoord); break;\n", i, i);
+    }
+    length += snprintf(fragmentSource + length, size - length,
+            "default: color = vec4(1.0); break;\n"
+            "}\n"
+            "color *= oColor;\n");
+    if (features->flags & O2D_SHADER_TINT)
+        length += snprintf(fragmentSource + length, size - length, "color *= uTint;\n");
+    if (features->flags & O2D_SHADER_ALPHA_TEST)
+        length += snprintf(fragmentSource + length, size - length, "if (color.a < uAlphaThreshold) discard;\n");
+    snprintf(fragmentSource + length, size - length,
+            "FragColor = color;\n"
+        "}\n");
+}
+
+O2D_ShaderVariant *_O2D_FindShaderVariant(O2D_Renderer* renderer, O2D_ShaderFeatures features) {
+    for (uint32_t i = 0; i < renderer->shaderVariantNum; i++) {
+        O2D_ShaderFeatures *other = &renderer->shaderVariants[i].features;
+        if (other->slotNum == features.slotNum && other->vertexFormat == features.vertexFormat &&
+            other->flags == features.flags)
+            return &renderer->shaderVariants[i];
+    }
+    return NULL;
+}
+
+O2D_ShaderVariant *_O2D_FindClosestShaderVariant(O2D_Renderer* renderer, O2D_ShaderFeatures features) {
+    O2D_ShaderVariant *closest = NULL;
+    uint32_t closestCost = UINT32_MAX;
+    for (uint32_t i = 0; i < renderer->shaderVariantNum; i++) {
+        O2D_ShaderFeatures *other = &renderer->shaderVariants[i].features;
+        // Another vertex format reads the wrong layout
+        if (other->vertexFormat != features.vertexFormat)
+            continue;
+        // Extra tint or alpha test only cost time, anything else draws differently
+        uint8_t wrong = (features.flags & ~other->flags) |
+                        (other->flags & ~features.flags & (O2D_SHADER_BINDLESS | O2D_SHADER_OVERDRAW));
+        uint8_t extra = other->flags & ~features.flags & ~wrong;
+        uint32_t cost = other->slotNum != features.slotNum ? 64 : 0;
+        for (uint8_t bit = 1; bit != 0; bit <<= 1)
+            cost += (wrong & bit ? 8 : 0) + (extra & bit ? 1 : 0);
+        if (cost < closestCost) {
+            closest = &renderer->shaderVariants[i];
+            closestCost = cost;
+        }
+    }
+    // A full table holds every flag combination of both formats
+    assert(closest != NULL);
+    return closest;
+}
+
+O2D_ShaderVariant *_O2D_GetShaderVariant(O2D_Renderer* renderer, O2D_ShaderFeatures features, bool wait) {
+    O2D_ShaderVariant *variant = _O2D_FindShaderVariant(renderer, features);
+    if (variant == NULL) {
+        if (renderer->shaderVariantNum == O2D_MAX_SHADER_VARIANTS) {
+            printf("Too many shader variants, using the closest one.\n");
+            return _O2D_GetShaderVariant(renderer, _O2D_FindClosestShaderVariant(renderer, features)->features, wait);
+        }
+        static char vertexSource[O2D_SHADER_SOURCE_SIZE];
+        static char fragmentSource[O2D_SHADER_SOURCE_SIZE];
+        _O2D_GenerateShaderSources(&features, vertexSource, fragmentSource, O2D_SHADER_SOURCE_SIZE);
+        variant = &renderer->shaderVariants[renderer->shaderVariantNum++];
+        O2D_ZeroMem(variant, sizeof(O2D_ShaderVariant));
+        variant->features = features;
+        variant->cacheIndex = _O2D_RequestProgram(renderer, vertexSource, fragmentSource);
+    }
+    if (!wait || variant->program != 0)
+        return variant;
+    // While it still compiles in parallel, a variant with every optional feature draws the same,
+    // its tint and alpha test just do nothing. Only if it is ready, otherwise this one is waited for
+    if (!_O2D_ProgramReady(renderer, variant->cacheIndex)) {
+        O2D_ShaderFeatures superset = features;
+        superset.flags |= O2D_SHADER_TINT | O2D_SHADER_ALPHA_TEST;
+        O2D_ShaderVariant *fallback = _O2D_FindShaderVariant(renderer, superset);
+        if (fallback != NULL && fallback != variant &&
+            (fallback->program != 0 || _O2D_ProgramReady(renderer, fallback->cacheIndex)))
+            return _O2D_GetShaderVariant(renderer, superset, true);
+    }
+
+    variant->program = _O2D_GetProgram(renderer, variant->cacheIndex);
+    variant->viewProjLocation = glGetUniformLocation(variant->program, "uViewProj");
+    variant->tintLocation = glGetUniformLocation(variant->program, "uTint");
+    variant->alphaThresholdLocation = glGetUniformLocation(variant->program, "uAlphaThreshold");
+    int32_t samplers[O2D_MAX_TEX_SLOTS];
+    for (int32_t i = 0; i < O2D_MAX_TEX_SLOTS; i++)
+        samplers[i] = i;
+    glProgramUniform1iv(variant->program, glGetUniformLocation(variant->program, "uTextures"),
+                        features.slotNum, samplers);
+    return variant;
+}
+
+O2D_ShaderFeatures _O2D_GetStateFeatures(O2D_Renderer* renderer, const O2D_RenderState *state) {
+    O2D_ShaderFeatures features = { renderer->streams[O2D_PASS_ORDERED].textureSlots.slotNum, state->vertexFormat, 0 };
+    if (state->tint[0] != 1.0f || state->tint[1] != 1.0f || state->tint[2] != 1.0f || state->tint[3] != 1.0f)
+        features.flags |= O2D_SHADER_TINT;
+    if (state->alphaThreshold > 0.0f)
+        features.flags |= O2D_SHADER_ALPHA_TEST;
+    if (renderer->overdraw.active)
+        features.flags |= O2D_SHADER_OVERDRAW;
+    return features;
+}
+
+void _O2D_ApplyRenderState(O2D_Renderer* renderer, const O2D_RenderState *state, const float viewProj[16]) {
+    O2D_ShaderVariant *variant = _O2D_GetShaderVariant(renderer, _O2D_GetStateFeatures(renderer, state), true);
+    _O2D_UseProgram(renderer, variant->program);
+    renderer->shader = variant->program;
+    renderer->projectionMatrixUniformLocation = variant->viewProjLocation;
+    if (!variant->uniformsValid || memcmp(variant->viewProj, viewProj, sizeof(variant->viewProj)) != 0) {
+        glUniformMatrix4fv(variant->viewProjLocation, 1, GL_FALSE, viewProj);
+        memcpy(variant->viewProj, viewProj, sizeof(variant->viewProj));
+    }
+    if ((variant->features.flags & O2D_SHADER_TINT) &&
+        (!variant->uniformsValid || memcmp(variant->tint, state->tint, sizeof(variant->tint)) != 0)) {
+        glUniform4fv(variant->tintLocation, 1, state->tint);
+        memcpy(variant->tint, state->tint, sizeof(variant->tint));
+    }
+    if ((variant->features.flags & O2D_SHADER_ALPHA_TEST) &&
+        (!variant->uniformsValid || variant->alphaThreshold != state->alphaThreshold)) {
+        glUniform1f(variant->alphaThresholdLocation, state->alphaThreshold);
+        variant->alphaThreshold = state->alphaThreshold;
+    }
+    variant->uniformsValid = true;
+    _O2D_SetBlendingState(renderer, state->blending);
+    _O2D_SetDepthState(renderer, state->depthTest, state->depthWrite);
+}
+
+void _O2D_UseProgram(O2D_Renderer* renderer, uint32_t program) {
+    if (renderer->stateCache.program != program) {
+        glUseProgram(program);
+        renderer->stateCache.program = program;
+    }
+}
+
+void _O2D_BindVertexArray(O2D_Renderer* renderer, uint32_t vertexArray) {
+    if (renderer->stateCache.vertexArray != vertexArray) {
+        glBindVertexArray(vertexArray);
+        renderer->stateCache.vertexArray = vertexArray;
+    }
+}
+
+void _O2D_BindArrayBuffer(O2D_Renderer* renderer, uint32_t buffer) {
+    if (renderer->stateCache.arrayBuffer != buffer) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        renderer->stateCache.arrayBuffer = buffer;
+    }
+}
+
+void _O2D_BindTextureUnit(O2D_Renderer* renderer, uint32_t unit, uint32_t texture) {
+    if (renderer->stateCache.textures[unit] != texture) {
+        glBindTextureUnit(unit, texture);
+        renderer->stateCache.textures[unit] = texture;
+    }
+}
+
+void _O2D_SetBlendingState(O2D_Renderer* renderer, bool enable) {
+    if (renderer->stateCache.blending != enable) {
+        if (enable)
+            glEnable(GL_BLEND);
+        else
+            glDisable(GL_BLEND);
+        renderer->stateCache.blending = enable;
+    }
+}
+
+void _O2D_SetDepthState(O2D_Renderer* renderer, bool test, bool write) {
+    if (renderer->stateCache.depthTest != test) {
+        if (test)
+            glEnable(GL_DEPTH_TEST);
+        else
+            glDisable(GL_DEPTH_TEST);
+        renderer->stateCache.depthTest = test;
+    }
+    if (renderer->stateCache.depthWrite != write) {
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+        renderer->stateCache.depthWrite = write;
+    }
+}
+
+void _O2D_InitProgramCache(O2D_Renderer* renderer) {
+    O2D_ProgramCache *cache = &renderer->programCache;
+    const char *strings[3] = {
+        (const char*)glGetString(GL_VENDOR),
+        (const char*)glGetString(GL_RENDERER),
+        (const char*)glGetString(GL_VERSION)
+    };
+    cache->driverHash = 14695981039346656037ull;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (strings[i] != NULL)
+            cache->driverHash = _O2D_HashBytes(cache->driverHash, strings[i], strlen(strings[i]));
+    }
+    O2D_PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads =
+        (O2D_PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile") && maxShaderCompilerThreads != NULL) {
+        maxShaderCompilerThreads(0xFFFFFFFF); // As many as the driver wants
+        cache->parallelCompile = true;
+    }
+}
+
+void _O2D_ReleaseProgramCache(O2D_Renderer* renderer) {
+    O2D_ProgramCache *cache = &renderer->programCache;
+    for (uint32_t i = 0; i < cache->entryNum; i++) {
+        if (cache->entries[i].pending) {
+            glDeleteShader(cache->entries[i].vertexShader);
+            glDeleteShader(cache->entries[i].fragmentShader);
+        }
+        glDeleteProgram(cache->entries[i].program);
+    }
+    _O2D_Free(cache->entries);
+    O2D_ZeroMem(cache, sizeof(O2D_ProgramCache));
+}
+
+void _O2D_GetProgramBinaryPath(O2D_Renderer* renderer, uint64_t hash, char *path, size_t size) {
+    snprintf(path, size, "%s/o2d_%016llx_%016llx.bin", _O2D_shaderCacheDirectory,
+             (unsigned long long)hash, (unsigned long long)renderer->programCache.driverHash);
+}
+
+uint32_t _O2D_RequestProgram(O2D_Renderer* renderer, const char *vertexSource, const char *fragmentSource) {
+    O2D_ProgramCache *cache = &renderer->programCache;
+    uint64_t hash = _O2D_HashBytes(14695981039346656037ull, vertexSource, strlen(vertexSource));
+    hash = _O2D_HashBytes(hash, fragmentSource, strlen(fragmentSource) + 1);
+    for (uint32_t i = 0; i < cache->entryNum; i++) {
+        if (cache->entries[i].hash == hash)
+            return i;
+    }
+    if (cache->entryNum == cache->entryCapacity) {
+        cache->entryCapacity = cache->entryCapacity ? cache->entryCapacity * 2 : 8;
+        cache->entries = _O2D_Realloc(cache->entries, cache->entryCapacity * sizeof(O2D_ProgramCacheEntry));
+    }
+    O2D_ProgramCacheEntry *entry = &cache->entries[cache->entryNum];
+    O2D_ZeroMem(entry, sizeof(O2D_ProgramCacheEntry));
+    entry->hash = hash;
+    entry->program = glCreateProgram();
+
+    // Try the binary left by a previous run
+    if (_O2D_shaderCacheDirectory[0] != '\0') {
+        char path[300];
+        _O2D_GetProgramBinaryPath(renderer, hash, path, sizeof(path));
+        FILE *file = fopen(path, "rb");
+        if (file != NULL) {
+            uint32_t header[2]; // Binary format, length
+            if (fread(header, sizeof(header), 1, file) == 1) {
+                void *binary = _O2D_Malloc(header[1]);
+                if (fread(binary, 1, header[1], file) == header[1]) {
+                    int32_t success = 0;
+                    glProgramBinary(entry->program, header[0], binary, header[1]);
+                    glGetProgramiv(entry->program, GL_LINK_STATUS, &success);
+                    entry->fromDisk = success;
+                }
+                _O2D_Free(binary);
+            }
+            fclose(file);
+        }
+        if (entry->fromDisk)
+            return cache->entryNum++;
+        // The driver rejected it, start over with a fresh program
+        glDeleteProgram(entry->program);
+        entry->program = glCreateProgram();
+    }
+
+    // Compile from source. Without parallel compilation these calls block, otherwise the
+    // result is only checked in _O2D_GetProgram()
+    entry->vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(entry->vertexShader, 1, &vertexSource, NULL);
+    glCompileShader(entry->vertexShader);
+    entry->fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(entry->fragmentShader, 1, &fragmentSource, NULL);
+    glCompileShader(entry->fragmentShader);
+    glAttachShader(entry->program, entry->vertexShader);
+    glAttachShader(entry->program, entry->fragmentShader);
+    if (_O2D_shaderCacheDirectory[0] != '\0')
+        glProgramParameteri(entry->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(entry->program);
+    entry->pending = true;
+    return cache->entryNum++;
+}
+
+bool _O2D_ProgramReady(O2D_Renderer* renderer, uint32_t index) {
+    O2D_ProgramCacheEntry *entry = &renderer->programCache.entries[index];
+    if (!entry->pending || !renderer->programCache.parallelCompile)
+        return true;
+    int32_t completed = 0;
+    glGetProgramiv(entry->program, GL_COMPLETION_STATUS_KHR, &completed);
+    return completed;
+}
+
+uint32_t _O2D_GetProgram(O2D_Renderer* renderer, uint32_t index) {
+    O2D_ProgramCacheEntry *entry = &renderer->programCache.entries[index];
+    if (!entry->pending)
+        return entry->program;
+    entry->pending = false;
+
+    int32_t success;
+    char errorLog[512];
+    glGetShaderiv(entry->vertexShader, GL_COMPILE_STATUS, &success);
+    if(!success) {
+        glGetShaderInfoLog(entry->vertexShader, 512, NULL, errorLog);
+        printf("VERTEX SHADER: COMPILATION_FAILED:\n%s\n", errorLog);
+    }
+    glGetShaderiv(entry->fragmentShader, GL_COMPILE_STATUS, &success);
+    if(!success) {
+        glGetShaderInfoLog(entry->fragmentShader, 512, NULL, errorLog);
+        printf("FRAGMENT SHADER: COMPILATION FAILED:\n%s\n", errorLog);
+    }
+    glGetProgramiv(entry->program, GL_LINK_STATUS, &success);
+    if(!success) {
+        glGetProgramInfoLog(entry->program, 512, NULL, errorLog);
+        printf("SHADER: LINKING FAILED:\n%s\n", errorLog);
+    }
+    glDetachShader(entry->program, entry->vertexShader);
+    glDetachShader(entry->program, entry->fragmentShader);
+    glDeleteShader(entry->vertexShader);
+    glDeleteShader(entry->fragmentShader);
+    if (!success || _O2D_shaderCacheDirectory[0] == '\0')
+        return entry->program;
+
+    // Store the binary for the next run
+    int32_t length = 0;
+    glGetProgramiv(entry->program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return entry->program;
+    uint32_t header[2] = { 0, (uint32_t)length };
+    void *binary = _O2D_Malloc(length);
+    glGetProgramBinary(entry->program, length, NULL, &header[0], binary);
+    char path[300];
+    _O2D_GetProgramBinaryPath(renderer, entry->hash, path, sizeof(path));
+    FILE *file = fopen(path, "wb");
+    if (file != NULL) {
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(binary, 1, length, file);
+        fclose(file);
+    }
+    else {
+        printf("Could not write shader cache file %s.\n", path);
+    }
+    _O2D_Free(binary);
+    return entry->program;
+}
+
+uint64_t _O2D_HashBuffer(const void *data, size_t size) {
+    // The XXH64 primes and rounds
+    const uint64_t primes[5] = { 11400714785074694791ull, 14029467366897019727ull, 1609587929392839161ull,
+                                 9650029242287828579ull, 2870177450012600261ull };
+    const uint8_t *bytes = data;
+    uint64_t lanes[4] = { primes[0] + primes[1], primes[1], 0, -primes[0] };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (uint8_t j = 0; j < 4; j++) {
+            uint64_t word;
+            memcpy(&word, bytes + i + j * 8, sizeof(word));
+            lanes[j] += word * primes[1];
+            lanes[j] = (lanes[j] << 31 | lanes[j] >> 33) * primes[0];
+        }
+    }
+    uint64_t hash = (lanes[0] << 1 | lanes[0] >> 63) + (lanes[1] << 7 | lanes[1] >> 57) +
+                    (lanes[2] << 12 | lanes[2] >> 52) + (lanes[3] << 18 | lanes[3] >> 46) + size;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        word *= primes[1];
+        hash ^= (word << 31 | word >> 33) * primes[0];
+        hash = (hash << 27 | hash >> 37) * primes[0] + primes[3];
+    }
+    for (; i < size; i++) {
+        hash ^= bytes[i] * primes[4];
+        hash = (hash << 11 | hash >> 53) * primes[0];
+    }
+    hash ^= hash >> 33;
+    hash *= primes[1];
+    hash ^= hash >> 29;
+    hash *= primes[2];
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t _O2D_HashBytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void _O2D_ComputeViewProjMatrix(O2D_Renderer* renderer) {
+    if (renderer->viewProjValid && renderer->viewProjCamera[0] == renderer->cameraX &&
+        renderer->viewProjCamera[1] == renderer->cameraY && renderer->viewProjSize[0] == renderer->width &&
+        renderer->viewProjSize[1] == renderer->height)
+        return;
+    renderer->viewProjValid = true;
+    renderer->viewProjCamera[0] = renderer->cameraX;
+    renderer->viewProjCamera[1] = renderer->cameraY;
+    renderer->viewProjSize[0] = renderer->width;
+    renderer->viewProjSize[1] = renderer->height;
+    float left   = -renderer->width / 2.0f;
+    float right  = renderer->width / 2.0f;
+    float top    = -renderer->height / 2.0f;
+    float bottom = renderer->height / 2.0f;
+    float near   = -1.0f;
+    float far    = 1.0f;
+    renderer->viewProjMatrix[0]  = 2.0f / renderer->width;
+    renderer->viewProjMatrix[1]  = 0;
+    renderer->viewProjMatrix[2]  = 0;
+    renderer->viewProjMatrix[3]  = (right + left) / renderer->width;
+    renderer->viewProjMatrix[4]  = 0;
+    renderer->viewProjMatrix[5]  = -2.0f / renderer->height;
+    renderer->viewProjMatrix[6]  = 0;
+    renderer->viewProjMatrix[7]  = (top + bottom) / renderer->height;
+    renderer->viewProjMatrix[8]  = 0;
+    renderer->viewProjMatrix[9]  = 0;
+    renderer->viewProjMatrix[10] = -2.0f / (far - near);
+    renderer->viewProjMatrix[11] = -(far + near) / (far - near);
+    renderer->viewProjMatrix[12] = 0;
+    renderer->viewProjMatrix[13] = 0;
+    renderer->viewProjMatrix[14] = 0;
+    renderer->viewProjMatrix[15] = 1;
+
+    _O2D_TranslateMatrix(renderer, renderer->viewProjMatrix, renderer->cameraX, renderer->cameraY);
+}
+
+void _O2D_RotatePoint(float *pointX, float *pointY, float pivotX, float pivotY, float angle) {
+  float s = sin(angle);
+  float c = cos(angle);
+
+  // translate point back to origin:
+  *pointX -= pivotX;
+  *pointY -= pivotY;
+
+  // rotate point
+  float xnew = *pointX * c - *pointY * s;
+  float ynew = *pointX * s + *pointY * c;
+
+  // translate point back:
+  *pointX = xnew + pivotX;
+  *pointY = ynew + pivotY;
+}
+
+int _O2D_ComparePoints(const void *a, const void *b) {
+    const float *pointA = a, *pointB = b;
+    if (pointA[0] != pointB[0])
+        return pointA[0] < pointB[0] ? -1 : 1;
+    return pointA[1] < pointB[1] ? -1 : pointA[1] > pointB[1];
+}
+
+float _O2D_Cross(const float o[2], const float a[2], const float b[2]) {
+    return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+uint32_t _O2D_ConvexHull(float (*points)[2], uint32_t pointNum) {
+    if (pointNum < 3)
+        return pointNum;
+    // Andrew's monotone chain, collinear points are dropped
+    qsort(points, pointNum, sizeof(float[2]), _O2D_ComparePoints);
+    float (*hull)[2] = _O2D_Malloc(2 * pointNum * sizeof(float[2]));
+    uint32_t hullNum = 0;
+    for (uint32_t i = 0; i < pointNum; i++) {
+        while (hullNum >= 2 && _O2D_Cross(hull[hullNum - 2], hull[hullNum - 1], points[i]) <= 0.0f)
+            hullNum--;
+        memcpy(hull[hullNum++], points[i], sizeof(float[2]));
+    }
+    for (uint32_t i = pointNum - 1, lower = hullNum + 1; i-- > 0;) {
+        while (hullNum >= lower && _O2D_Cross(hull[hullNum - 2], hull[hullNum - 1], points[i]) <= 0.0f)
+            hullNum--;
+        memcpy(hull[hullNum++], points[i], sizeof(float[2]));
+    }
+    hullNum--; // The first point closes the loop again
+    memcpy(points, hull, hullNum * sizeof(float[2]));
+    _O2D_Free(hull);
+    return hullNum;
+}
+
+uint32_t _O2D_SimplifyHull(float (*points)[2], uint32_t pointNum, uint32_t maxPoints, const float bounds[4]) {
+    const float epsilon = 1e-3f;
+    while (pointNum > maxPoints && pointNum > 3) {
+        // Dropping edge (b, c) moves b to where the lines through (a, b) and (c, d) meet
+        uint32_t best = pointNum;
+        float bestArea = INFINITY, bestPoint[2];
+        for (uint32_t i = 0; i < pointNum; i++) {
+            const float *a = points[(i + pointNum - 1) % pointNum], *b = points[i];
+            const float *c = points[(i + 1) % pointNum], *d = points[(i + 2) % pointNum];
+            float ab[2] = { b[0] - a[0], b[1] - a[1] }, cd[2] = { d[0] - c[0], d[1] - c[1] };
+            float denominator = ab[0] * cd[1] - ab[1] * cd[0];
+            // The lines only meet in front of the edge if they turn by less than 180 degrees
+            if (denominator <= epsilon)
+                continue;
+            float t = ((c[0] - b[0]) * cd[1] - (c[1] - b[1]) * cd[0]) / denominator;
+            float point[2] = { b[0] + ab[0] * t, b[1] + ab[1] * t };
+            if (t < 0.0f || point[0] < bounds[0] - epsilon || point[0] > bounds[2] + epsilon ||
+                point[1] < bounds[1] - epsilon || point[1] > bounds[3] + epsilon)
+                continue;
+            float area = fabsf(_O2D_Cross(b, c, point)) / 2.0f;
+            if (area < bestArea) {
+                bestArea = area;
+                best = i;
+                bestPoint[0] = fminf(fmaxf(point[0], bounds[0]), bounds[2]);
+                bestPoint[1] = fminf(fmaxf(point[1], bounds[1]), bounds[3]);
+            }
+        }
+        if (best == pointNum)
+            break;
+        memcpy(points[best], bestPoint, sizeof(bestPoint));
+        uint32_t removed = (best + 1) % pointNum;
+        memmove(points[removed], points[removed + 1], (pointNum - removed - 1) * sizeof(float[2]));
+        pointNum--;
+    }
+    return pointNum;
 }
 
 void _O2D_TranslateMatrix(O2D_Renderer* renderer, float mat[16], float dx, float dy) {
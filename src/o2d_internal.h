@@ -0,0 +1,421 @@
+#ifndef O2D_INTERNAL_H
+#define O2D_INTERNAL_H
+
+// Declarations shared by o2d.c and the tests. Not part of the API, o2d.h only has what its
+// inline fast paths need
+
+#include "../include/o2d.h"
+
+// Trace zones around the frame phases. Build with O2D_ENABLE_TRACE defined to record them,
+// otherwise the macros compile to nothing. Names must be string literals
+#ifdef O2D_ENABLE_TRACE
+#define O2D_ZONE_BEGIN(name) _O2D_TraceEvent(name, 'B')
+#define O2D_ZONE_END(name) _O2D_TraceEvent(name, 'E')
+#else
+#define O2D_ZONE_BEGIN(name)
+#define O2D_ZONE_END(name)
+#endif
+
+// A triangle or sprite of a recorded stream, see _O2D_CollectDirtyRects()
+typedef struct O2D_PrimitiveCursor_t {
+    const O2D_BatchStream *stream;
+    uint32_t batch;  // stream->batchNum past the last primitive
+    uint32_t vertex; // First vertex, a sprite counts as 6 like in O2D_Batch
+} O2D_PrimitiveCursor;
+
+// The fields the calls of a capture are XORed with, kept the same way by the writer and the reader
+typedef struct O2D_CaptureHistory_t {
+    uint32_t *calls[O2D_CAPTURE_OP_NUM]; // Fields of every call of a kind, by position in the frame
+    uint32_t callNum[O2D_CAPTURE_OP_NUM];     // In this frame
+    uint32_t lastCallNum[O2D_CAPTURE_OP_NUM]; // In the previous frame
+    uint32_t capacity[O2D_CAPTURE_OP_NUM];
+} O2D_CaptureHistory;
+
+typedef struct O2D_Capture_t {
+    uint8_t buffer[O2D_CAPTURE_BUFFER_SIZE];
+    uint32_t length;
+    bool failed; // A write came up short
+    O2D_CaptureHistory history;
+    bool *textures; // Whether a texture was recorded already, indexed by texture name
+    uint32_t textureCapacity;
+} O2D_Capture;
+
+typedef struct O2D_CaptureReader_t {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    O2D_CaptureHistory history;
+} O2D_CaptureReader;
+
+// The running capture, defined in o2d.c. Its calls are encoded into the buffer without a file
+// until it fills up
+extern O2D_Capture _O2D_capture;
+
+// Utility: Records a trace event on the calling thread's ring buffer. Use the O2D_ZONE macros
+void _O2D_TraceEvent(const char *name, char phase);
+
+// Utility: Writes the trace events recorded since the given time as comma separated JSON
+// objects. Returns the number of events written
+uint32_t _O2D_TraceWriteEvents(FILE *file, uint64_t since, bool first);
+
+// Utility: Returns a monotonic timestamp in nanoseconds
+uint64_t _O2D_GetTimeNs(void);
+
+// Utility: Sleeps for roughly the given number of nanoseconds
+void _O2D_SleepNs(uint64_t duration);
+
+// Utility: Waits until the frame limiter deadline
+void _O2D_PaceFrame(O2D_FrameLimiter *limiter);
+
+// Utility: Starts the GPU timing of a frame, reading back the results of an older one. Deletes
+// the queries when enable is false
+void _O2D_BeginGpuFrame(O2D_Renderer* renderer, uint64_t frameIndex, bool enable);
+
+// Utility: Ends the GPU timing of the current frame
+void _O2D_EndGpuFrame(O2D_Renderer* renderer);
+
+// Utility: Reads back the results of a finished frame if they are available
+void _O2D_CollectGpuFrame(O2D_Renderer* renderer, O2D_GpuTimerFrame *frame);
+
+// Utility: Deletes the GPU timer queries
+void _O2D_ReleaseGpuTimers(O2D_Renderer* renderer);
+
+// Utility: Copies the latest GPU timings into the frame stats
+void _O2D_CopyGpuResults(O2D_Renderer* renderer, O2D_FrameStats *stats);
+
+// Utility: Starts counting the fragments of a frame if enable is true
+void _O2D_BeginOverdrawFrame(O2D_Renderer* renderer, uint16_t width, uint16_t height, bool enable);
+
+// Utility: Reads the fragment counts of the frame back and builds the report and heatmap
+void _O2D_EndOverdrawFrame(O2D_Renderer* renderer, uint64_t frameIndex);
+
+// Utility: Deletes the overdraw textures
+void _O2D_ReleaseOverdrawProfiler(O2D_Renderer* renderer);
+
+// Utility: Issues a draw call, timing it if the GPU timers are enabled
+void _O2D_DrawTimed(O2D_Renderer* renderer, uint32_t firstVertex, uint32_t vertexNum);
+
+// Utility: Starts timing a draw if the GPU timers are enabled and have room for it. Returns
+// whether _O2D_EndTimedDraw() has to be called after the draw
+bool _O2D_BeginTimedDraw(O2D_Renderer* renderer);
+
+// Utility: Stops timing the draw started by _O2D_BeginTimedDraw()
+void _O2D_EndTimedDraw(O2D_Renderer* renderer);
+
+// Utility: Closes the open batch of every pass, e.g. before the render state changes
+void _O2D_CloseBatch(O2D_Renderer* renderer);
+
+// Utility: Closes the open batch of a pass, keeping its vertices and texture slots for later submission
+void _O2D_CloseStreamBatch(O2D_Renderer* renderer, O2D_BatchStream *stream);
+
+// Utility: Returns the stream of the pass that geometry with texture and alpha belongs to
+O2D_BatchStream *_O2D_SelectStream(O2D_Renderer* renderer, uint32_t texture, float alpha);
+
+// Utility: Switches the open batch of a pass to another vertex stream, closing it if necessary
+void _O2D_SetBatchFormat(O2D_Renderer* renderer, O2D_BatchStream *stream, uint8_t vertexFormat);
+
+// Utility: Returns the slot of texture in the open batch, giving it a free one or starting a
+// new batch if needed
+int16_t _O2D_GetTextureSlot(O2D_Renderer* renderer, O2D_BatchStream *stream, uint32_t texture);
+
+// Utility: Closes every pass and puts the opaque one in front to back order for submission
+void _O2D_FinishStreams(O2D_Renderer* renderer);
+
+// Utility: Reverses the order of the triangles, sprites and batches of a stream
+void _O2D_ReverseStream(O2D_BatchStream *stream);
+
+// Utility: Empties a stream, keeping its memory
+void _O2D_ResetStream(O2D_BatchStream *stream);
+
+// Utility: Returns true if the streams hold no batches
+bool _O2D_StreamsEmpty(const O2D_BatchStream *streams);
+
+// Utility: Clears the color buffer, and the depth buffer if depth is true
+void _O2D_ClearFrame(O2D_Renderer* renderer, bool depth);
+
+// Utility: Uploads the vertices and sprites of every pass at once and draws their batches in
+// pass order, the way submitMode says. Frames over the policy's cap go to _O2D_SubmitBatchesChunked().
+// Returns the bytes it didn't upload because they were resident
+uint64_t _O2D_SubmitBatches(O2D_Renderer* renderer, const O2D_BatchStream *streams, const float viewProj[16],
+                        uint8_t submitMode, const O2D_BufferPolicy *policy);
+
+// Utility: Draws the batches of every pass in order, uploading the parts of the streams they
+// use in windows of at most maxVertices vertices (maxVertices / 6 sprites) and splitting
+// batches that don't fit in one
+void _O2D_SubmitBatchesChunked(O2D_Renderer* renderer, const O2D_BatchStream *streams, const float viewProj[16],
+                               uint32_t maxVertices);
+
+// Utility: Capacity for required elements under policy. capacity if it is enough already
+uint32_t _O2D_GrowCapacity(const O2D_BufferPolicy *policy, uint32_t required, uint32_t capacity);
+
+// Utility: Records a submission that used used of capacity elements. Returns the capacity to
+// shrink to once enough quiet submissions went by, capacity otherwise. Never more than capacity
+uint32_t _O2D_DecayCapacity(const O2D_BufferPolicy *policy, O2D_BufferUsage *usage, uint32_t used, uint32_t capacity);
+
+// Utility: Records the use of a stream's buffers before it is reset, shrinking them when they decayed
+void _O2D_TrimStream(O2D_Renderer* renderer, O2D_BatchStream *stream);
+
+// Utility: Sets sealVertexNum for the submit mode, render thread, depth sorting and dirty rectangles in use
+void _O2D_UpdateStreaming(O2D_Renderer* renderer);
+
+// Utility: Seals the open chunk if the ordered stream can't take vertexNum more vertices and
+// spriteNum more sprites into it. Call before getting texture slots, sealing closes the batch
+void _O2D_MakeChunkRoom(O2D_Renderer* renderer, O2D_BatchStream *stream, uint32_t vertexNum, uint32_t spriteNum);
+
+// Utility: Uploads the ordered stream into the streaming ring, draws its batches and resets it
+void _O2D_SealChunk(O2D_Renderer* renderer);
+
+// Utility: Copies size bytes into the next chunk of the streaming ring through an
+// unsynchronized mapping, waiting first if the GPU still reads it. Returns the chunk
+uint32_t _O2D_WriteStreamChunk(O2D_Renderer* renderer, const void *data, uint32_t size);
+
+// Utility: Creates the ring buffer and its vertex array in the main context, on first use
+void _O2D_InitStreamRing(O2D_Renderer* renderer);
+
+// Utility: Deletes the streaming ring and the fences still pending on it
+void _O2D_ReleaseStreamRing(O2D_Renderer* renderer);
+
+// Utility: Draws the uploaded batches with one glMultiDrawArraysIndirect() per run of batches
+// with the same blending, depth state and vertex format, their textures and state read from
+// SSBOs. vertexBases and spriteBases tell where every pass starts in the GPU buffers
+void _O2D_DrawBatchesIndirect(O2D_Renderer* renderer, const O2D_BatchStream *streams,
+                              const uint32_t vertexBases[O2D_PASS_NUM], const uint32_t spriteBases[O2D_PASS_NUM],
+                              const float viewProj[16]);
+
+// Utility: Submits the rest of the frame with dirty rectangles, without a render thread
+void _O2D_EndDirtyFrame(O2D_Renderer* renderer);
+
+// Utility: Draws a whole frame into the dirty rectangle framebuffer, only where it differs from
+// the previous one, and copies it to the window. Returns the bytes _O2D_SubmitBatches() elided
+uint64_t _O2D_SubmitDirtyFrame(O2D_Renderer* renderer, const O2D_BatchStream *streams, const float viewProj[16],
+                               const float clearColor[4], uint8_t submitMode, const O2D_BufferPolicy *policy,
+                               bool depth, uint16_t width, uint16_t height);
+
+// Utility: Fills the dirty rectangles from the differences between streams and the previous frame
+void _O2D_CollectDirtyRects(O2D_Renderer* renderer, const O2D_BatchStream *streams, const float viewProj[16],
+                            const float clearColor[4], bool depth, uint16_t width, uint16_t height);
+
+// Utility: Returns a cursor on the first triangle or sprite of stream
+O2D_PrimitiveCursor _O2D_FirstPrimitive(const O2D_BatchStream *stream);
+
+// Utility: Moves cursor to the next triangle or sprite of its stream, in push order
+void _O2D_NextPrimitive(O2D_PrimitiveCursor *cursor);
+
+// Utility: Returns how many primitives after from the first one matching target is, up to
+// O2D_DIRTY_LOOKAHEAD. UINT32_MAX if none is
+uint32_t _O2D_FindPrimitive(O2D_PrimitiveCursor from, const O2D_PrimitiveCursor *target);
+
+// Utility: Returns the texture of slot in batch, O2D_NO_TEXTURE for O2D_WHITE_SLOT
+uint32_t _O2D_SlotTexture(const O2D_Batch *batch, uint32_t slot);
+
+// Utility: Whether two primitives draw the same pixels, with the same state and textures
+bool _O2D_PrimitivesMatch(const O2D_PrimitiveCursor *a, const O2D_PrimitiveCursor *b);
+
+// Utility: Adds the screen bounds of the triangle (or sprite) at primitive to the dirty rectangles
+void _O2D_AddDirtyPrimitive(O2D_DirtyTracker *dirty, const O2D_PrimitiveCursor *primitive, const float viewProj[16],
+                            uint16_t width, uint16_t height);
+
+// Utility: Adds rect to the dirty rectangles, merging it with those it touches, or with the one
+// it grows the least when there is no room left
+void _O2D_AddDirtyRect(O2D_DirtyTracker *dirty, const int32_t rect[4]);
+
+// Utility: (Re)creates the dirty rectangle framebuffer at width x height and binds it
+void _O2D_BindDirtyFramebuffer(O2D_Renderer* renderer, uint16_t width, uint16_t height);
+
+// Utility: Copies the dirty rectangle framebuffer to the window's and binds the window's
+void _O2D_BlitDirtyFramebuffer(O2D_Renderer* renderer);
+
+// Utility: Deletes the dirty rectangle framebuffer and the copy of the previous frame
+void _O2D_ReleaseDirtyRects(O2D_Renderer* renderer);
+
+// Utility: Copies the vertices, sprites and batches of src into dst, growing its buffers by the policy
+void _O2D_CopyStream(O2D_BatchStream *dst, const O2D_BatchStream *src, const O2D_BufferPolicy *policy);
+
+// Utility: Checks the driver for bindless textures and draw parameters
+void _O2D_InitIndirectSubmit(O2D_Renderer* renderer);
+
+// Utility: Deletes the indirect submission buffers
+void _O2D_ReleaseIndirectSubmit(O2D_Renderer* renderer);
+
+// Utility: Returns the resident bindless handle of texture, creating it on first use
+uint64_t _O2D_GetTextureHandle(O2D_Renderer* renderer, uint32_t texture);
+
+// Utility: Hands the recorded frame to the render thread once it has finished the previous one
+void _O2D_QueueFrame(O2D_Renderer* renderer);
+
+// Utility: Adds the last finished frame to the flight recorder and dumps the window on a hitch
+void _O2D_RecordFlightFrame(O2D_Renderer* renderer);
+
+// Utility: Swap interval of the current context, -1 if the platform can't tell (GLX and WGL can)
+int32_t _O2D_QuerySwapInterval(void);
+
+// Utility: Writes the flight recorder window to disk
+bool _O2D_DumpFlightRecorder(O2D_Renderer* renderer);
+
+// Utility: Grows the vertex buffer capacity by the policy growth if necessary
+void _O2D_EnsureVtxBufSize(const O2D_BufferPolicy *policy, O2D_VertexBuffer *vtxBuf, uint32_t requiredCapacity);
+
+// Utility: Grows the sprite buffer capacity by the policy growth if necessary
+void _O2D_EnsureSpriteBufSize(const O2D_BufferPolicy *policy, O2D_SpriteBuffer *spriteBuf, uint32_t requiredCapacity);
+
+// Utility: Returns true if texture was created from data with full alpha everywhere, or is O2D_NO_TEXTURE
+bool _O2D_TextureIsOpaque(uint32_t texture);
+
+// Utility: Lowest alpha of the vertex colors, from 0 to 1
+float _O2D_VertexAlpha(const O2D_Vertex *vertices, uint32_t vertexNum);
+
+// Utility: Product of two RGBA8 colors
+uint32_t _O2D_MultiplyColor(uint32_t a, uint32_t b);
+
+// Utility: Compiles the default shader variant. With parallel compilation it also starts compiling
+// the others in the background
+void _O2D_CreateShaders(O2D_Renderer* renderer);
+
+// Utility: Writes the sources of the shader described by features
+void _O2D_GenerateShaderSources(const O2D_ShaderFeatures *features, char *vertexSource,
+                                char *fragmentSource, size_t size);
+
+// Utility: Returns the variant for features, or NULL if it was never requested
+O2D_ShaderVariant *_O2D_FindShaderVariant(O2D_Renderer* renderer, O2D_ShaderFeatures features);
+
+// Utility: Returns the variant with the same vertex format that draws features the closest, for
+// when the variant table is full. Missing flags and other samplers count more than extra flags
+O2D_ShaderVariant *_O2D_FindClosestShaderVariant(O2D_Renderer* renderer, O2D_ShaderFeatures features);
+
+// Utility: Returns the variant for features, starting its compilation if needed. If wait is
+// true the returned variant's program is ready to be used. That can be a ready variant with
+// every optional feature while the requested one still compiles in parallel
+O2D_ShaderVariant *_O2D_GetShaderVariant(O2D_Renderer* renderer, O2D_ShaderFeatures features, bool wait);
+
+// Utility: Returns the features needed to draw with state
+O2D_ShaderFeatures _O2D_GetStateFeatures(O2D_Renderer* renderer, const O2D_RenderState *state);
+
+// Utility: Binds the shader variant and sets the GL state for drawing with state
+void _O2D_ApplyRenderState(O2D_Renderer* renderer, const O2D_RenderState *state, const float viewProj[16]);
+
+// Utility: State cache aware glUseProgram()
+void _O2D_UseProgram(O2D_Renderer* renderer, uint32_t program);
+
+// Utility: State cache aware glBindVertexArray()
+void _O2D_BindVertexArray(O2D_Renderer* renderer, uint32_t vertexArray);
+
+// Utility: State cache aware glBindBuffer(GL_ARRAY_BUFFER, ...)
+void _O2D_BindArrayBuffer(O2D_Renderer* renderer, uint32_t buffer);
+
+// Utility: State cache aware glBindTextureUnit()
+void _O2D_BindTextureUnit(O2D_Renderer* renderer, uint32_t unit, uint32_t texture);
+
+// Utility: State cache aware glEnable/glDisable(GL_BLEND)
+void _O2D_SetBlendingState(O2D_Renderer* renderer, bool enable);
+
+// Utility: State cache aware glEnable/glDisable(GL_DEPTH_TEST) and glDepthMask()
+void _O2D_SetDepthState(O2D_Renderer* renderer, bool test, bool write);
+
+// Utility: Checks the driver for parallel compilation support and fingerprints it
+void _O2D_InitProgramCache(O2D_Renderer* renderer);
+
+// Utility: Deletes every cached program
+void _O2D_ReleaseProgramCache(O2D_Renderer* renderer);
+
+// Utility: Starts building a program, from memory, from a binary on disk or from source.
+// Returns its cache index. Compilation runs in the background if the driver supports it
+uint32_t _O2D_RequestProgram(O2D_Renderer* renderer, const char *vertexSource, const char *fragmentSource);
+
+// Utility: Returns true if the program can be used without waiting for the compiler
+bool _O2D_ProgramReady(O2D_Renderer* renderer, uint32_t index);
+
+// Utility: Returns the program, waiting for it to finish linking and storing its binary on disk
+uint32_t _O2D_GetProgram(O2D_Renderer* renderer, uint32_t index);
+
+// Utility: FNV-1a hash of size bytes, chained on hash
+uint64_t _O2D_HashBytes(uint64_t hash, const void *data, size_t size);
+
+// Utility: 64 bit hash of size bytes in four independent lanes of 8 bytes, for buffers too
+// big for _O2D_HashBytes()
+uint64_t _O2D_HashBuffer(const void *data, size_t size);
+
+// Utility: Updates the projection matrix without touching GL, if the camera or size changed
+void _O2D_ComputeViewProjMatrix(O2D_Renderer* renderer);
+
+// Utility: qsort comparator ordering points by x, then y
+int _O2D_ComparePoints(const void *a, const void *b);
+
+// Utility: Z component of (a - o) x (b - o), positive if o, a, b turn counter clockwise
+float _O2D_Cross(const float o[2], const float a[2], const float b[2]);
+
+// Utility: Encodes a call into the running capture
+void _O2D_CaptureCall(uint8_t op, const uint32_t *words, uint32_t wordNum);
+
+// Utility: Writes x, y, u, v and color of every vertex as capture fields
+void _O2D_CaptureVertices(uint32_t *words, const O2D_Vertex *vertices, uint32_t vertexNum);
+
+// Utility: Returns where the fields of the next call of kind op are kept, and in base the fields
+// it is XORed with. base must be read before the returned slot is written, they can be the same
+uint32_t *_O2D_NextCaptureSlot(O2D_CaptureHistory *history, uint8_t op, const uint32_t **base);
+
+// Utility: Starts a new frame of history. Called on O2D_CAPTURE_BEGIN
+void _O2D_NextCaptureFrame(O2D_CaptureHistory *history);
+
+// Utility: Frees the fields kept by history
+void _O2D_ReleaseCaptureHistory(O2D_CaptureHistory *history);
+
+// Utility: Records a texture and its pixels (data can be NULL) into the running capture
+void _O2D_CaptureTexture(uint32_t texture, const uint8_t *data, int32_t width, int32_t height);
+
+// Utility: Reads texture back and records it, unless the running capture already has it
+void _O2D_CaptureTextureUse(uint32_t texture);
+
+// Utility: Writes the encoded calls of the running capture to its file
+bool _O2D_FlushCapture(void);
+
+// Utility: Decodes the fields of the next call, whose opcode was just read. Returns false past
+// the end of the capture
+bool _O2D_ReadCaptureCall(O2D_CaptureReader *reader, uint8_t op, uint32_t *words);
+
+// Utility: Decodes and runs the next call of a capture. textureMap translates recorded texture
+// names and grows with the textures created. Returns false on a malformed capture
+bool _O2D_ReplayCall(O2D_Renderer* renderer, O2D_CaptureReader *reader, uint32_t **textureMap,
+                     uint32_t *textureMapCapacity, O2D_ReplayStats *stats);
+
+// Utility: malloc() through the allocator set with O2D_SetAllocator(), counted per thread
+void *_O2D_Malloc(size_t size);
+
+// Utility: calloc() through the allocator set with O2D_SetAllocator()
+void *_O2D_Calloc(size_t number, size_t size);
+
+// Utility: realloc() through the allocator set with O2D_SetAllocator()
+void *_O2D_Realloc(void *ptr, size_t size);
+
+// Utility: free() through the allocator set with O2D_SetAllocator()
+void _O2D_Free(void *ptr);
+
+// Utility: Empties the arena. If the last frame overflowed it, it is reallocated to fit it
+void _O2D_ResetFrameArena(O2D_FrameArena *arena);
+
+// Utility: Frees the arena's memory
+void _O2D_ReleaseFrameArena(O2D_FrameArena *arena);
+
+// Utility: Bit pattern of a float, for the capture fields
+uint32_t _O2D_FloatBits(float value);
+
+// Utility: Float with the given bit pattern
+float _O2D_BitsFloat(uint32_t bits);
+
+// Utility: Replaces points by their convex hull in counter clockwise order. Returns the hull size
+uint32_t _O2D_ConvexHull(float (*points)[2], uint32_t pointNum);
+
+// Utility: Removes hull edges, extending their neighbours to meet, until at most maxPoints are
+// left. Picks the removal adding the least area that stays inside bounds (minX, minY, maxX,
+// maxY). Returns the new size, which stays above maxPoints if no removal fits
+uint32_t _O2D_SimplifyHull(float (*points)[2], uint32_t pointNum, uint32_t maxPoints, const float bounds[4]);
+
+// Utility: Translates mat by (dx, dy, 0). Note: dx and dy are in world space, not screen space
+void _O2D_TranslateMatrix(O2D_Renderer* renderer, float mat[16], float dx, float dy);
+
+// Utility: Rotates mat by angle (radians)
+void _O2D_RotateMatrix(float mat[16], float angle);
+
+// Utility: Rotates point another another point (pivot) by angle (radians)
+void _O2D_RotatePoint(float *pointX, float *pointY, float pivotX, float pivotY, float angle);
+
+#endif
@@ -0,0 +1,283 @@
+/*
+* Checks the parts of the library that need no window or GL context on fixed inputs.
+* Run by make test, exits with 1 if a check failed.
+*/
+#include "../src/o2d_internal.h"
+
+static uint32_t checkNum, failNum;
+
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static void Check(bool passed, const char *condition, int line) {
+    checkNum++;
+    if (!passed) {
+        printf("test.c:%d: %s\n", line, condition);
+        failNum++;
+    }
+}
+
+// Whether point is inside the counter clockwise hull, or on it
+static bool HullContains(const float (*hull)[2], uint32_t pointNum, const float point[2]) {
+    for (uint32_t i = 0; i < pointNum; i++) {
+        if (_O2D_Cross(hull[i], hull[(i + 1) % pointNum], point) < -1e-4f)
+            return false;
+    }
+    return true;
+}
+
+static void TestConvexHull(void) {
+    // A square with points inside it and on its edges
+    float points[9][2] = { { 2, 1 }, { 0, 0 }, { 4, 4 }, { 1, 2 }, { 4, 0 }, { 2, 0 }, { 0, 4 }, { 3, 3 }, { 0, 2 } };
+    float original[9][2];
+    memcpy(original, points, sizeof(points));
+    uint32_t pointNum = _O2D_ConvexHull(points, 9);
+    CHECK(pointNum == 4);
+    for (uint32_t i = 0; i < pointNum; i++) {
+        CHECK((points[i][0] == 0 || points[i][0] == 4) && (points[i][1] == 0 || points[i][1] == 4));
+        CHECK(_O2D_Cross(points[i], points[(i + 1) % pointNum], points[(i + 2) % pointNum]) > 0);
+    }
+    for (uint32_t i = 0; i < 9; i++)
+        CHECK(HullContains((const float (*)[2])points, pointNum, original[i]));
+}
+
+static void TestSimplifyHull(void) {
+    // A regular octagon with vertical and horizontal edges. Dropping its diagonal edges leaves
+    // its bounding square, the only 4 point outline inside the bounds
+    float points[8][2];
+    for (uint32_t i = 0; i < 8; i++) {
+        float angle = (float)(i * 2 + 1) * 3.14159265f / 8.0f;
+        points[i][0] = cosf(angle);
+        points[i][1] = sinf(angle);
+    }
+    float octagon[8][2];
+    memcpy(octagon, points, sizeof(points));
+    float half = cosf(3.14159265f / 8.0f);
+    const float bounds[4] = { -half, -half, half, half };
+    uint32_t pointNum = _O2D_SimplifyHull(points, 8, 4, bounds);
+    CHECK(pointNum == 4);
+    for (uint32_t i = 0; i < pointNum; i++)
+        CHECK(fabsf(fabsf(points[i][0]) - half) < 1e-3f && fabsf(fabsf(points[i][1]) - half) < 1e-3f);
+    for (uint32_t i = 0; i < 8; i++)
+        CHECK(HullContains((const float (*)[2])points, pointNum, octagon[i]));
+
+    // A triangle is left as it is, and so is a hull whose every removal would leave the bounds
+    float triangle[3][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 } };
+    CHECK(_O2D_SimplifyHull(triangle, 3, 2, bounds) == 3);
+    memcpy(points, octagon, sizeof(points));
+    const float tight[4] = { -0.5f, -0.5f, 0.5f, 0.5f };
+    CHECK(_O2D_SimplifyHull(points, 8, 4, tight) == 8);
+}
+
+// Encodes the calls of two frames, then decodes them and compares the fields
+static void TestCaptureCodec(void) {
+    enum { CALL_NUM = 7 };
+    static const uint8_t ops[CALL_NUM] = { O2D_CAPTURE_BEGIN, O2D_CAPTURE_QUAD, O2D_CAPTURE_SPRITE_MESH, O2D_CAPTURE_END,
+                                           O2D_CAPTURE_BEGIN, O2D_CAPTURE_QUAD, O2D_CAPTURE_QUAD };
+    static uint32_t words[CALL_NUM][O2D_CAPTURE_MAX_WORDS];
+    static const uint32_t wordNums[CALL_NUM] = { 0, 21, 22 + 3 * 2, 0, 0, 21, 21 };
+    for (uint32_t i = 0; i < 21; i++) {
+        words[1][i] = i * 0x01010101u;
+        words[5][i] = words[1][i] ^ (i == 3 ? 0x80000000u : 0); // One high bit away from the first frame
+        words[6][i] = UINT32_MAX - i;                           // More calls than the first frame
+    }
+    words[2][0] = 3;
+    for (uint32_t i = 1; i < wordNums[2]; i++)
+        words[2][i] = _O2D_FloatBits((float)i * 0.5f);
+
+    O2D_Capture *capture = &_O2D_capture;
+    capture->length = 0;
+    uint32_t frameLengths[2] = { 0 };
+    for (uint32_t i = 0; i < CALL_NUM; i++) {
+        uint32_t length = capture->length;
+        _O2D_CaptureCall(ops[i], words[i], wordNums[i]);
+        frameLengths[i >= 4] += capture->length - length;
+    }
+    // The first quad takes up to 5 bytes a field, its repeat 1 byte for 20 of them
+    CHECK(frameLengths[1] < frameLengths[0]);
+
+    O2D_CaptureReader reader = { .data = capture->buffer, .size = capture->length };
+    for (uint32_t i = 0; i < CALL_NUM; i++) {
+        uint32_t decoded[O2D_CAPTURE_MAX_WORDS] = { 0 };
+        CHECK(reader.offset < reader.size && reader.data[reader.offset] == ops[i]);
+        uint8_t op = reader.data[reader.offset++];
+        CHECK(_O2D_ReadCaptureCall(&reader, op, decoded));
+        CHECK(memcmp(decoded, words[i], wordNums[i] * sizeof(uint32_t)) == 0);
+    }
+    CHECK(reader.offset == reader.size);
+
+    // A capture cut in the middle of a field is rejected
+    O2D_CaptureReader cut = { .data = capture->buffer, .size = 3 };
+    uint32_t decoded[O2D_CAPTURE_MAX_WORDS];
+    uint8_t op = cut.data[cut.offset++];
+    CHECK(_O2D_ReadCaptureCall(&cut, op, decoded));
+    op = cut.data[cut.offset++];
+    CHECK(!_O2D_ReadCaptureCall(&cut, op, decoded));
+
+    _O2D_ReleaseCaptureHistory(&capture->history);
+    _O2D_ReleaseCaptureHistory(&reader.history);
+    _O2D_ReleaseCaptureHistory(&cut.history);
+    capture->length = 0;
+}
+
+// Runs submissions of used elements through _O2D_DecayCapacity, returns the last capacity
+static uint32_t Decay(const O2D_BufferPolicy *policy, O2D_BufferUsage *usage, const uint32_t *used, uint32_t usedNum,
+                      uint32_t capacity) {
+    for (uint32_t i = 0; i < usedNum; i++)
+        capacity = _O2D_DecayCapacity(policy, usage, used[i], capacity);
+    return capacity;
+}
+
+static void TestBufferPolicy(void) {
+    O2D_BufferPolicy policy = { 1.5f, 3, 6000, false };
+    CHECK(_O2D_GrowCapacity(&policy, 100, 200) == 200);
+    CHECK(_O2D_GrowCapacity(&policy, 1000, 200) == 1500);
+    CHECK(_O2D_GrowCapacity(&policy, 10, 0) == O2D_MIN_VTX_NUM);
+    CHECK(_O2D_GrowCapacity(&policy, 5000, 1000) == 6000); // Capped
+    CHECK(_O2D_GrowCapacity(&policy, 7000, 1000) == 7000); // Over the cap, but what is required
+    policy.maxVertices = 0;
+    CHECK(_O2D_GrowCapacity(&policy, 5000, 1000) == 7500);
+
+    // Shrinks to the quiet peak times growth after decayFrames quiet submissions
+    O2D_BufferUsage usage = { 0 };
+    const uint32_t quiet[3] = { 300, 400, 200 };
+    CHECK(Decay(&policy, &usage, quiet, 2, 1000) == 1000);
+    CHECK(_O2D_DecayCapacity(&policy, &usage, quiet[2], 1000) == 600);
+    CHECK(usage.quietFrames == 0 && usage.quietPeak == 0);
+    // A busy submission starts over
+    const uint32_t busy[3] = { 300, 600, 300 };
+    CHECK(Decay(&policy, &usage, busy, 3, 1000) == 1000);
+    CHECK(usage.quietFrames == 1);
+    usage = (O2D_BufferUsage){ 0 };
+    // Never below O2D_MIN_VTX_NUM, and never from there
+    const uint32_t idle[3] = { 1, 1, 1 };
+    CHECK(Decay(&policy, &usage, idle, 3, 1000) == O2D_MIN_VTX_NUM);
+    CHECK(Decay(&policy, &usage, idle, 3, O2D_MIN_VTX_NUM) == O2D_MIN_VTX_NUM);
+    // A growth factor putting the target above the capacity keeps the capacity
+    policy.growth = 4.0f;
+    CHECK(Decay(&policy, &usage, quiet, 3, 1000) == 1000);
+    // 0 decay frames never shrink
+    policy.decayFrames = 0;
+    CHECK(Decay(&policy, &usage, idle, 3, 1000) == 1000);
+}
+
+static void TestHashBuffer(void) {
+    // 3 blocks of 32 bytes for the lanes, then 8 byte words and single bytes
+    enum { SIZE = 3 * 32 + 2 * 8 + 5 };
+    static uint8_t data[SIZE + 1], moved[SIZE + 8];
+    for (uint32_t i = 0; i < SIZE; i++)
+        data[i] = (uint8_t)(i * 7 + 1);
+    uint64_t hash = _O2D_HashBuffer(data, SIZE);
+    // Only the bytes count, not where they are
+    memcpy(moved + 3, data, SIZE);
+    CHECK(_O2D_HashBuffer(moved + 3, SIZE) == hash);
+    // Every byte changes it
+    bool allChange = true;
+    for (uint32_t i = 0; i < SIZE; i++) {
+        data[i] ^= 0x10;
+        allChange &= _O2D_HashBuffer(data, SIZE) != hash;
+        data[i] ^= 0x10;
+    }
+    CHECK(allChange);
+    // So do the order of the blocks and the size, even with zeros past the end
+    memcpy(moved, data + 32, 32);
+    memcpy(moved + 32, data, 32);
+    memcpy(moved + 64, data + 64, SIZE - 64);
+    CHECK(_O2D_HashBuffer(moved, SIZE) != hash);
+    CHECK(_O2D_HashBuffer(data, SIZE + 1) != hash);
+    CHECK(_O2D_HashBuffer(data, 0) == _O2D_HashBuffer(moved, 0));
+}
+
+static void TestDirtyRects(void) {
+    static O2D_DirtyTracker dirty;
+    const int32_t left[4] = { 0, 0, 10, 10 }, right[4] = { 20, 0, 30, 10 }, between[4] = { 8, 2, 22, 4 };
+    _O2D_AddDirtyRect(&dirty, left);
+    _O2D_AddDirtyRect(&dirty, right);
+    CHECK(dirty.rectNum == 2);
+    // Touching both merges all three, the result is merged again with what it grew into
+    _O2D_AddDirtyRect(&dirty, between);
+    CHECK(dirty.rectNum == 1);
+    CHECK(dirty.rects[0][0] == 0 && dirty.rects[0][1] == 0 && dirty.rects[0][2] == 30 && dirty.rects[0][3] == 10);
+    // Sharing an edge is touching
+    const int32_t above[4] = { 5, 10, 15, 20 };
+    _O2D_AddDirtyRect(&dirty, above);
+    CHECK(dirty.rectNum == 1 && dirty.rects[0][3] == 20);
+
+    // Past O2D_MAX_DIRTY_RECTS, a rectangle goes into the one it grows the least
+    dirty.rectNum = 0;
+    for (int32_t i = 0; i < O2D_MAX_DIRTY_RECTS; i++) {
+        const int32_t rect[4] = { i * 100, 0, i * 100 + 10, 10 };
+        _O2D_AddDirtyRect(&dirty, rect);
+    }
+    CHECK(dirty.rectNum == O2D_MAX_DIRTY_RECTS);
+    const int32_t near[4] = { 312, 0, 320, 10 };
+    _O2D_AddDirtyRect(&dirty, near);
+    CHECK(dirty.rectNum == O2D_MAX_DIRTY_RECTS);
+    bool grown = false;
+    for (uint32_t i = 0; i < dirty.rectNum; i++)
+        grown |= dirty.rects[i][0] == 300 && dirty.rects[i][2] == 320;
+    CHECK(grown);
+}
+
+static void TestPrimitiveMatching(void) {
+    // Ten triangles in two batches, then the same with one pushed before the fifth
+    enum { TRIANGLE_NUM = 10 };
+    static O2D_Vertex previousVertices[TRIANGLE_NUM * 3], currentVertices[(TRIANGLE_NUM + 1) * 3];
+    for (uint32_t i = 0; i < TRIANGLE_NUM * 3; i++)
+        previousVertices[i] = (O2D_Vertex){ (float)i, (float)(i % 3), 0, 0, 0, (float)i, 0xFFFFFFFF };
+    memcpy(currentVertices, previousVertices, 4 * 3 * sizeof(O2D_Vertex));
+    for (uint32_t i = 0; i < 3; i++)
+        currentVertices[4 * 3 + i] = (O2D_Vertex){ -1, (float)i, 0, 0, 0, 0, 0xFF0000FF };
+    memcpy(currentVertices + 5 * 3, previousVertices + 4 * 3, 6 * 3 * sizeof(O2D_Vertex));
+    for (uint32_t i = 5 * 3; i < (TRIANGLE_NUM + 1) * 3; i++)
+        currentVertices[i].z += 1.0f;
+    // The batch boundaries differ too, and depth is not compared without the depth test
+    O2D_Batch previousBatches[2] = { { .firstVertex = 0, .vertexNum = 12 }, { .firstVertex = 12, .vertexNum = 18 } };
+    O2D_Batch currentBatches[3] = { { .firstVertex = 0, .vertexNum = 6 }, { .firstVertex = 6, .vertexNum = 0 },
+                                    { .firstVertex = 6, .vertexNum = 27 } };
+    O2D_BatchStream previous = { .vtxBuf = { previousVertices, TRIANGLE_NUM * 3 }, .batches = previousBatches,
+                                 .batchNum = 2 };
+    O2D_BatchStream current = { .vtxBuf = { currentVertices, (TRIANGLE_NUM + 1) * 3 }, .batches = currentBatches,
+                                .batchNum = 3 };
+
+    O2D_PrimitiveCursor a = _O2D_FirstPrimitive(&previous), b = _O2D_FirstPrimitive(&current);
+    uint32_t matchNum = 0;
+    for (; matchNum < 4 && _O2D_PrimitivesMatch(&a, &b); matchNum++) {
+        _O2D_NextPrimitive(&a);
+        _O2D_NextPrimitive(&b);
+    }
+    CHECK(matchNum == 4);
+    CHECK(!_O2D_PrimitivesMatch(&a, &b));
+    // One pushed, none gone
+    CHECK(_O2D_FindPrimitive(b, &a) == 1);
+    CHECK(_O2D_FindPrimitive(a, &b) == UINT32_MAX);
+    _O2D_NextPrimitive(&b);
+    while (a.batch < previous.batchNum && b.batch < current.batchNum && _O2D_PrimitivesMatch(&a, &b)) {
+        _O2D_NextPrimitive(&a);
+        _O2D_NextPrimitive(&b);
+        matchNum++;
+    }
+    CHECK(matchNum == TRIANGLE_NUM);
+    CHECK(a.batch == previous.batchNum && b.batch == current.batchNum);
+
+    // The same vertices with another texture in their slot don't match
+    a = _O2D_FirstPrimitive(&previous);
+    b = _O2D_FirstPrimitive(&current);
+    previousBatches[0].usedSlots = currentBatches[0].usedSlots = 1;
+    previousBatches[0].textures[0] = 1;
+    currentBatches[0].textures[0] = 2;
+    CHECK(!_O2D_PrimitivesMatch(&a, &b));
+    currentBatches[0].textures[0] = 1;
+    CHECK(_O2D_PrimitivesMatch(&a, &b));
+}
+
+int main(void) {
+    TestConvexHull();
+    TestSimplifyHull();
+    TestCaptureCodec();
+    TestBufferPolicy();
+    TestHashBuffer();
+    TestDirtyRects();
+    TestPrimitiveMatching();
+    printf("%u checks, %u failed\n", checkNum, failNum);
+    return failNum > 0 ? 1 : 0;
+}